@@ -1,4 +1,7 @@
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /* strdup под -std=c11 */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,9 +21,10 @@ typedef struct Node {
 } Node;
 
 
+/* NULL если не хватило памяти: решает вызывающий (movdino не должен падать из-за трассы) */
 static Node* newNode(unsigned char c, uint64_t freq) {
     Node *n = (Node*)malloc(sizeof(Node));
-    if (!n) { perror("malloc"); exit(EXIT_FAILURE); }
+    if (!n) return NULL;
     n->c = c; n->freq = freq; n->left = n->right = n->next = NULL;
     return n;
 }
@@ -65,12 +69,18 @@ static Node* pop_min(Node **phead) {
     return min;
 }
 
-/* Построение дерева Хаффмана из таблицы частот (без кучи) */
+/* список (по next) вместе с поддеревьями — когда дерево не достроилось */
+static void freeList(Node *head) {
+    while (head) { Node *t = head; head = head->next; freeTree(t); }
+}
+
+/* Построение дерева Хаффмана из таблицы частот (без кучи); NULL — пусто или не хватило памяти */
 static Node* build_tree(uint64_t freq[ALPH]) {
     Node *head = NULL;
     int unique = 0;
     for (int i = 0; i < ALPH; ++i) if (freq[i] > 0) {
         Node *n = newNode((unsigned char)i, freq[i]);
+        if (!n) { freeList(head); return NULL; }
         n->next = head; head = n;
         unique++;
     }
@@ -80,6 +90,7 @@ static Node* build_tree(uint64_t freq[ALPH]) {
         Node *only = pop_min(&head);
         Node *dummy = newNode(0, 0);
         Node *parent = newNode(0, only->freq);
+        if (!dummy || !parent) { free(only); free(dummy); free(parent); return NULL; }
         parent->left = only; parent->right = dummy;
         return parent;
     }
@@ -87,6 +98,7 @@ static Node* build_tree(uint64_t freq[ALPH]) {
         Node *a = pop_min(&head);
         Node *b = pop_min(&head);
         Node *p = newNode(0, a->freq + b->freq);
+        if (!p) { freeTree(a); freeTree(b); freeList(head); return NULL; }
         // меньший вес — влево; при равенстве — по символу (стабильность)
         if (a->freq < b->freq || (a->freq == b->freq && a->c <= b->c)) { p->left = a; p->right = b; }
         else { p->left = b; p->right = a; }
@@ -98,6 +110,99 @@ static Node* build_tree(uint64_t freq[ALPH]) {
     return root;
 }
 
+#ifdef HUFFMAN_NO_MAIN
+/*  Блоки в памяти (movdino.c включает этот файл с HUFFMAN_NO_MAIN и пишет так трассу кадров)
+    блок: исходная длина, число разных символов k, k пар (символ, частота),
+    длина битового потока в байтах, сам поток. дерево строится по частотам
+    тем же build_tree, поэтому декодеру хватает частот. память просит только
+    дерево; если её нет — возвращаем ошибку, а не выходим */
+#define HUFF_BLOCK_MAX_CODE 56 /* код вместе с хвостом прошлого влезает в 64 бита */
+
+/* коды битами, а не строками: bits — код, len — его длина; 0 если дерево слишком глубокое */
+static int gen_bits(const Node *r, uint64_t code, int depth, uint64_t bits[ALPH], int len[ALPH]) {
+    if (!r->left && !r->right) {
+        bits[r->c] = code; len[r->c] = depth;
+        return depth <= HUFF_BLOCK_MAX_CODE;
+    }
+    if (depth == HUFF_BLOCK_MAX_CODE) return 0;
+    return (!r->left || gen_bits(r->left, code << 1, depth + 1, bits, len))
+        && (!r->right || gen_bits(r->right, (code << 1) | 1, depth + 1, bits, len));
+}
+
+/* 1 — записан, 0 — не хватило памяти или не записалось */
+static int huff_write_block(FILE *out, const unsigned char *in, uint64_t n) {
+    uint64_t freq[ALPH] = {0};
+    for (uint64_t i = 0; i < n; ++i) freq[in[i]]++;
+
+    int uniq = 0;
+    for (int i = 0; i < ALPH; ++i) if (freq[i]) uniq++;
+    write_u64_le(out, n);
+    write_u64_le(out, (uint64_t)uniq);
+    for (int i = 0; i < ALPH; ++i) if (freq[i]) { fputc(i, out); write_u64_le(out, freq[i]); }
+    if (uniq <= 1) return !ferror(out); // один символ восстанавливается по частотам
+
+    Node *root = build_tree(freq);
+    uint64_t bits[ALPH] = {0}; int len[ALPH] = {0};
+    int ok = root && gen_bits(root, 0, 0, bits, len);
+    freeTree(root);
+    if (!ok) return 0;
+
+    uint64_t total = 0;
+    for (int i = 0; i < ALPH; ++i) total += freq[i] * (uint64_t)len[i];
+    write_u64_le(out, (total + 7) / 8);
+    uint64_t acc = 0; int filled = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        acc = (acc << len[in[i]]) | bits[in[i]];
+        filled += len[in[i]];
+        while (filled >= 8) { fputc((int)(acc >> (filled - 8) & 0xFF), out); filled -= 8; }
+    }
+    if (filled > 0) fputc((int)(acc << (8 - filled) & 0xFF), out);
+    return !ferror(out);
+}
+
+/* блок в out (не больше cap байт): его исходная длина, 0 — файл кончился,
+   -1 — блок повреждён или не хватило памяти на дерево */
+static long long huff_read_block(FILE *in, unsigned char *out, uint64_t cap) {
+    int c = fgetc(in);
+    if (c == EOF) return 0;
+    ungetc(c, in);
+
+    uint64_t n = read_u64_le(in), uniq = read_u64_le(in);
+    if (feof(in) || n == 0 || n > cap || uniq == 0 || uniq > ALPH) return -1;
+    uint64_t freq[ALPH] = {0}, sum = 0;
+    int only = 0;
+    for (uint64_t k = 0; k < uniq; ++k) {
+        int sym = fgetc(in);
+        if (sym == EOF || freq[sym]) return -1;
+        freq[sym] = read_u64_le(in);
+        if (feof(in) || freq[sym] == 0 || freq[sym] > n - sum) return -1;
+        sum += freq[sym];
+        only = sym;
+    }
+    if (sum != n) return -1;
+    if (uniq == 1) { memset(out, only, n); return (long long)n; }
+
+    uint64_t bytes = read_u64_le(in);
+    Node *root = build_tree(freq);
+    if (feof(in) || !root) { freeTree(root); return -1; }
+
+    Node *cur = root;
+    uint64_t written = 0, used = 0;
+    while (written < n && used < bytes) {
+        int b = fgetc(in);
+        if (b == EOF) break;
+        used++;
+        for (int k = 7; k >= 0 && written < n; --k) {
+            cur = ((b >> k) & 1) ? cur->right : cur->left;
+            if (!cur) { freeTree(root); return -1; }
+            if (!cur->left && !cur->right) { out[written++] = cur->c; cur = root; }
+        }
+    }
+    freeTree(root);
+    return written == n && used == bytes ? (long long)n : -1;
+}
+
+#else
 /*  Генерация кодов (строки "0101...")  */
 static void gen_codes(Node *r, char *buf, int depth, char *codes[ALPH]) {
     if (!r) return;
@@ -411,3 +516,4 @@ int main(int argc, char *argv[]) {
     printf("=== программа завершена ===\n");
     return 0;
 }
+#endif
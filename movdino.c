@@ -1,25 +1,59 @@
+// strdup, fdopen, clock_gettime, pthread_barrier_t — без них -std=c11 не соберётся
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+#include "movdino.h"
+#define HUFFMAN_NO_MAIN
+#include "huffman_lab2.c" // блочный Хаффман для трассы кадров
 
 ///КОМАНДЫ ДЛЯ ТЕРМИНАЛА
 ///  cd C:\mingw64
+///  gcc movdino.c -o movdino.exe -lpthread
 ///  .\movdino.exe program.txt.txt
+///  .\movdino.exe --batch -j 8 programs\          (пачка программ на всех ядрах)
+///  .\movdino.exe --seek 1000 program.txt.txt    (кадр после 1000-го шага)
+///  .\movdino.exe --load map.img --save out.img program.txt.txt   (старт с образа, итог в образ)
+///  .\movdino.exe --record run.trc program.txt.txt  (кадры в сжатую трассу)
+///  .\movdino.exe --replay run.trc                 (те же кадры обратно)
+///  .\movdino.exe --crowd -j 8 map.img agents.txt (много дино на одном поле)
+///  .\movdino.exe --gen -s 1 -n 100000 -m jump > big.txt   (случайная программа)
+///  .\movdino.exe --bench --sweep -l rev1 -o bench.tsv     (замеры, строка в таблицу)
+///  gcc tests\movdino_test.c -o movdino_test.exe -lpthread && .\movdino_test.exe   (проверки)
 
 
-struct Field {
-    int w, h;
-    char **tiles;
-    int dino_x, dino_y;
-    int has_dino;
-    char **colors;
-};
 //ПОЛЕ
 int init_field(struct Field *f, int w, int h) {
+    if (f->tiles) free_field(f);
+    f->pass_ver++;
+
     f->w = w;
     f->h = h;
     f->has_dino = 0;
+    f->zhash = 0; // свежее поле — все клетки по умолчанию
+
+    f->row_words = (w + 63) / 64;
+    f->col_words = (h + 63) / 64;
+    f->row_block = calloc((size_t)h * f->row_words, sizeof(uint64_t));
+    f->col_block = calloc((size_t)w * f->col_words, sizeof(uint64_t));
 
     f->tiles = malloc(h * sizeof(char *));
     f->colors = malloc(h * sizeof(char *)); 
@@ -34,21 +68,387 @@ int init_field(struct Field *f, int w, int h) {
     return 1;
 }
 
+static void release_image(void *base, size_t len);
+static void free_paths(struct Field *f);
+
+void free_field(struct Field *f) {
+    if (f->image) {
+        release_image(f->image, f->image_len);
+        f->image = NULL;
+        f->image_len = 0;
+    } else {
+        for (int y = 0; y < f->h; y++) {
+            free(f->tiles[y]);
+            free(f->colors[y]);
+        }
+        free(f->row_block);
+        free(f->col_block);
+    }
+    free(f->tiles);
+    free(f->colors);
+    free_paths(f);
+    f->tiles = NULL;
+    f->colors = NULL;
+    f->row_block = NULL;
+    f->col_block = NULL;
+}
+
+static int is_block(char c) {
+    return c == '^' || c == '&' || c == '@';
+}
+
+/// клетки, которые бывают на поле
+static int is_tile(char c) {
+    return c == '_' || c == '%' || is_block(c);
+}
+
+/// краска — видимый символ ASCII (пробел значит «без краски», его ставит CLEAR)
+static int is_paint(char c) {
+    return c > ' ' && c <= '~';
+}
+
+/// ключ Зобриста для клетки: перемешанные (номер клетки, слой, значение);
+/// значение по умолчанию ('_' или ' ') даёт 0, поэтому пустое поле хешируется в 0
+static uint64_t zkey(const struct Field *f, int x, int y, int plane, char c) {
+    if (c == (plane ? ' ' : '_')) return 0;
+    uint64_t z = (((uint64_t)y * f->w + x) << 9) | ((uint64_t)plane << 8) | (unsigned char)c;
+    z += 0x9E3779B97F4A7C15ULL; // splitmix64
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/// хеш Зобриста всего поля с нуля
+static uint64_t full_zhash(const struct Field *f) {
+    uint64_t z = 0;
+    if (!f->tiles) return 0;
+    for (int y = 0; y < f->h; y++)
+        for (int x = 0; x < f->w; x++)
+            z ^= zkey(f, x, y, 0, f->tiles[y][x]) ^ zkey(f, x, y, 1, f->colors[y][x]);
+    return z;
+}
+
+/// включить хеш Зобриста и посчитать его для текущего поля с нуля
+void zobrist_on(struct Field *f) {
+    f->zon = 1;
+    f->zhash = full_zhash(f);
+}
+
+static void log_cell(struct History *h, int x, int y, int plane, char old, char now);
+
+/// все изменения клеток идут через set_tile, чтобы индекс препятствий не врал
+void set_tile(struct Field *f, int x, int y, char c) {
+    if (f->log) log_cell(f->log, x, y, 0, f->tiles[y][x], c);
+    if (f->zon) f->zhash ^= zkey(f, x, y, 0, f->tiles[y][x]) ^ zkey(f, x, y, 0, c);
+    if ((is_block(c) || c == '%') != (is_block(f->tiles[y][x]) || f->tiles[y][x] == '%')) f->pass_ver++;
+    f->tiles[y][x] = c;
+
+    uint64_t *rw = &f->row_block[(size_t)y * f->row_words + (x >> 6)];
+    uint64_t *cw = &f->col_block[(size_t)x * f->col_words + (y >> 6)];
+    if (is_block(c)) {
+        *rw |= 1ULL << (x & 63);
+        *cw |= 1ULL << (y & 63);
+    } else {
+        *rw &= ~(1ULL << (x & 63));
+        *cw &= ~(1ULL << (y & 63));
+    }
+}
+
+/// краски — тоже только через set_color
+void set_color(struct Field *f, int x, int y, char c) {
+    if (f->log) log_cell(f->log, x, y, 1, f->colors[y][x], c);
+    if (f->zon) f->zhash ^= zkey(f, x, y, 1, f->colors[y][x]) ^ zkey(f, x, y, 1, c);
+    f->colors[y][x] = c;
+}
+
+// первый установленный бит с индексом >= from, -1 если нет (биты за n всегда нули)
+static int next_bit(const uint64_t *bits, int n, int from) {
+    if (from >= n) return -1;
+    int words = (n + 63) / 64;
+    int wi = from >> 6;
+    uint64_t word = bits[wi] & (~0ULL << (from & 63));
+    for (;;) {
+        if (word) return (wi << 6) + __builtin_ctzll(word);
+        if (++wi >= words) return -1;
+        word = bits[wi];
+    }
+}
+
+// последний установленный бит с индексом <= from, -1 если нет
+static int prev_bit(const uint64_t *bits, int from) {
+    if (from < 0) return -1;
+    int wi = from >> 6;
+    uint64_t word = bits[wi] & (~0ULL >> (63 - (from & 63)));
+    for (;;) {
+        if (word) return (wi << 6) + 63 - __builtin_clzll(word);
+        if (--wi < 0) return -1;
+        word = bits[wi];
+    }
+}
+
+// расстояние (1..n) до ближайшего препятствия вперёд по кольцу, 0 если его нет
+static int block_ahead(const uint64_t *bits, int n, int pos) {
+    int i = next_bit(bits, n, pos + 1);
+    if (i >= 0) return i - pos;
+    i = next_bit(bits, n, 0);
+    if (i >= 0 && i <= pos) return i + n - pos;
+    return 0;
+}
+
+// то же самое назад
+static int block_behind(const uint64_t *bits, int n, int pos) {
+    int i = prev_bit(bits, pos - 1);
+    if (i >= 0) return pos - i;
+    i = prev_bit(bits, n - 1);
+    if (i >= pos) return pos + n - i;
+    return 0;
+}
+
 //ВЫВОД ПОЛЯ
-void print_field(struct Field *f) {
+void fprint_field(FILE *out, struct Field *f) {
     if (!f->tiles) return;
+    uint64_t t0 = f->prof ? now_ns() : 0;
 
     for (int y = 0; y < f->h; y++) {
         for (int x = 0; x < f->w; x++) {
             if (f->has_dino && x == f->dino_x && y == f->dino_y)
-                putchar('#');
+                putc('#', out);
             else if (f->colors[y][x] != ' ')
-                putchar(f->colors[y][x]);
+                putc(f->colors[y][x], out);
             else
-                putchar(f->tiles[y][x]);
+                putc(f->tiles[y][x], out);
+        }
+        putc('\n', out);
+    }
+    if (f->prof) {
+        f->prof->frames++;
+        f->prof->render_bytes += (uint64_t)(f->w + 1) * f->h;
+        f->prof->render_ns += now_ns() - t0;
+    }
+}
+
+void print_field(struct Field *f) {
+    fprint_field(stdout, f);
+}
+
+/// тот же кадр, что печатает fprint_field, в out ((w + 1) * h байт); сколько записали
+size_t render_field(const struct Field *f, char *out) {
+    if (!f->tiles) return 0;
+
+    char *p = out;
+    for (int y = 0; y < f->h; y++) {
+        for (int x = 0; x < f->w; x++)
+            *p++ = f->colors[y][x] != ' ' ? f->colors[y][x] : f->tiles[y][x];
+        *p++ = '\n';
+    }
+    if (f->has_dino) out[(size_t)f->dino_y * (f->w + 1) + f->dino_x] = '#';
+    return p - out;
+}
+
+//ОБРАЗ ПОЛЯ
+/// двоичный файл: заголовок, индекс препятствий (row_block, col_block), потом tiles
+/// и colors построчно. порядок байт — как у машины, что писала. при загрузке файл
+/// отображается в память как есть (MAP_PRIVATE): ничего не разбирается, а
+/// страницы общие у всех симуляций, пока кто-то не поменяет клетку
+#define IMAGE_MAGIC "DINOIMG"
+#define IMAGE_VERSION 1
+
+struct FieldImage {
+    char magic[8];
+    uint32_t version;
+    int32_t w, h;
+    int32_t has_dino, dino_x, dino_y;
+    int32_t row_words, col_words;
+    uint64_t zhash; // хеш Зобриста содержимого (при загрузке не доверяем — считаем заново)
+    uint64_t reserved[2];
+};
+
+static size_t image_size(long w, long h, long row_words, long col_words) {
+    return sizeof(struct FieldImage) + (size_t)(h * row_words + w * col_words) * sizeof(uint64_t)
+         + 2 * (size_t)w * h;
+}
+
+int save_field(const struct Field *f, const char *path) {
+    if (!f->tiles) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    struct FieldImage hd = {0};
+    memcpy(hd.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    hd.version = IMAGE_VERSION;
+    hd.w = f->w;
+    hd.h = f->h;
+    hd.has_dino = f->has_dino;
+    hd.dino_x = f->dino_x;
+    hd.dino_y = f->dino_y;
+    hd.row_words = f->row_words;
+    hd.col_words = f->col_words;
+    hd.zhash = f->zon ? f->zhash : full_zhash(f);
+
+    // пишем рядом и подменяем файл целиком: кто отобразил старый образ (и мы сами,
+    // если сохраняем туда, откуда загрузились), продолжает видеть старые страницы
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 5);
+    if (!tmp) return 0;
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        free(tmp);
+        return 0;
+    }
+
+    int ok = fwrite(&hd, sizeof(hd), 1, file) == 1
+          && fwrite(f->row_block, sizeof(uint64_t), (size_t)f->h * f->row_words, file) == (size_t)f->h * f->row_words
+          && fwrite(f->col_block, sizeof(uint64_t), (size_t)f->w * f->col_words, file) == (size_t)f->w * f->col_words;
+    for (int y = 0; ok && y < f->h; y++) ok = fwrite(f->tiles[y], 1, f->w, file) == (size_t)f->w;
+    for (int y = 0; ok && y < f->h; y++) ok = fwrite(f->colors[y], 1, f->w, file) == (size_t)f->w;
+
+    if (fclose(file) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok) remove(path); // rename в Windows не заменяет существующий файл
+#endif
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) {
+        int e = errno;
+        remove(tmp);
+        errno = e;
+    }
+    free(tmp);
+    return ok;
+}
+
+#ifdef _WIN32
+/// без mmap: читаем файл целиком в один кусок памяти
+static void *map_image(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    void *base = NULL;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (size > 0 && fseek(file, 0, SEEK_SET) == 0 && (base = malloc(size))) {
+        if (fread(base, 1, size, file) != (size_t)size) {
+            free(base);
+            base = NULL;
+            errno = EIO;
+        }
+    } else if (size >= 0) {
+        errno = size ? ENOMEM : EINVAL;
+    }
+    fclose(file);
+    *len = (size_t)size;
+    return base;
+}
+
+static void release_image(void *base, size_t len) {
+    (void)len;
+    free(base);
+}
+#else
+static void *map_image(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *base = NULL;
+    if (fstat(fd, &st) == 0) {
+        if (st.st_size <= 0) {
+            errno = EINVAL;
+        } else {
+            base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) base = NULL;
+            *len = (size_t)st.st_size;
         }
-        putchar('\n');
     }
+    close(fd);
+    return base;
+}
+
+static void release_image(void *base, size_t len) {
+    munmap(base, len);
+}
+#endif
+
+/// индекс препятствий заново по клеткам: в образе он мог разойтись с ними
+static void rebuild_blocks(struct Field *f) {
+    memset(f->row_block, 0, (size_t)f->h * f->row_words * sizeof(uint64_t));
+    memset(f->col_block, 0, (size_t)f->w * f->col_words * sizeof(uint64_t));
+    for (int y = 0; y < f->h; y++)
+        for (int x = 0; x < f->w; x++)
+            if (is_block(f->tiles[y][x])) {
+                f->row_block[(size_t)y * f->row_words + (x >> 6)] |= 1ULL << (x & 63);
+                f->col_block[(size_t)x * f->col_words + (y >> 6)] |= 1ULL << (y & 63);
+            }
+}
+
+/// поле из образа; 0 и errno если файл не читается или это не образ (поле тогда не тронуто).
+/// клетки берутся как есть, а индекс препятствий и хеш пересчитываются из них
+/// (образ мог быть обрезан и дописан или поправлен руками)
+int load_field(struct Field *f, const char *path) {
+    size_t len = 0;
+    char *base = map_image(path, &len);
+    if (!base) return 0;
+
+    struct FieldImage hd;
+    int ok = len >= sizeof(hd);
+    if (ok) {
+        memcpy(&hd, base, sizeof(hd));
+        ok = memcmp(hd.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 && hd.version == IMAGE_VERSION
+          && hd.w > 0 && hd.h > 0
+          && hd.row_words == (hd.w + 63) / 64 && hd.col_words == (hd.h + 63) / 64
+          && len == image_size(hd.w, hd.h, hd.row_words, hd.col_words);
+    }
+
+    char **tiles = ok ? malloc(hd.h * sizeof(char *)) : NULL;
+    char **colors = ok ? malloc(hd.h * sizeof(char *)) : NULL;
+    if (!tiles || !colors) {
+        free(tiles);
+        free(colors);
+        release_image(base, len);
+        errno = ok ? ENOMEM : EINVAL;
+        return 0;
+    }
+
+    uint64_t *row_block = (uint64_t *)(base + sizeof(hd));
+    uint64_t *col_block = row_block + (size_t)hd.h * hd.row_words;
+    char *cells = (char *)(col_block + (size_t)hd.w * hd.col_words);
+    for (int y = 0; y < hd.h; y++) {
+        tiles[y] = cells + (size_t)y * hd.w;
+        colors[y] = cells + (size_t)(hd.h + y) * hd.w;
+    }
+
+    if (f->tiles) free_field(f);
+    f->w = hd.w;
+    f->h = hd.h;
+    f->tiles = tiles;
+    f->colors = colors;
+    f->row_words = hd.row_words;
+    f->col_words = hd.col_words;
+    f->row_block = row_block;
+    f->col_block = col_block;
+    f->has_dino = hd.has_dino && hd.dino_x >= 0 && hd.dino_x < hd.w && hd.dino_y >= 0 && hd.dino_y < hd.h;
+    f->dino_x = hd.dino_x;
+    f->dino_y = hd.dino_y;
+    rebuild_blocks(f);
+    f->zhash = full_zhash(f);
+    f->pass_ver++;
+    f->image = base;
+    f->image_len = len;
+    return 1;
+}
+
+/// соседняя клетка по направлению, с переходом через край (тор)
+static void step_dir(struct Field *f, int dir, int *x, int *y) {
+    if (dir == DIR_UP) (*y)--;
+    else if (dir == DIR_DOWN) (*y)++;
+    else if (dir == DIR_LEFT) (*x)--;
+    else if (dir == DIR_RIGHT) (*x)++;
+
+    if (*x < 0) *x = f->w - 1;
+    if (*x >= f->w) *x = 0;
+    if (*y < 0) *y = f->h - 1;
+    if (*y >= f->h) *y = 0;
 }
 
 
@@ -62,376 +462,151 @@ int place_dino(struct Field *f, int x, int y) {
     return 1;
 }
 ///ПЕРЕХОДЫ ДИНО
-void move_dino(struct Field *f, char *dir) {
-    if (!f->has_dino) return;
+int move_dino(struct Field *f, int dir) {
+    if (!f->has_dino) return DINO_RUNNING;
 
     int nx = f->dino_x;
     int ny = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ny--;
-    else if (strcmp(dir, "DOWN") == 0) ny++;
-    else if (strcmp(dir, "LEFT") == 0) nx--;
-    else if (strcmp(dir, "RIGHT") == 0) nx++;
-
-    if (nx < 0) nx = f->w - 1;
-    if (nx >= f->w) nx = 0;
-    if (ny < 0) ny = f->h - 1;
-    if (ny >= f->h) ny = 0;
+    step_dir(f, dir, &nx, &ny);
 
     char cell = f->tiles[ny][nx];
 
     // ЯМА НИЗЯЯЯЯ
-    if (cell == '%') exit(0);
+    if (cell == '%') {
+        if (f->prof) f->prof->falls++;
+        return DINO_FELL;
+    }
 
     // НИИИЗЯ НА ГОРУ, ДЕРЕВО И КАМЕНЬ
-    if (cell == '^' || cell == '&' || cell == '@') return;
+    if (cell == '^' || cell == '&' || cell == '@') {
+        if (f->prof) f->prof->move_blocked++;
+        return DINO_RUNNING;
+    }
     
 
     f->dino_x = nx;
     f->dino_y = ny;
+    return DINO_RUNNING;
 }
 /// ЯМААААА
 /// КОПАЕМ ЯМУ
-void dig_dino(struct Field *f, char *dir) {
+void dig_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int tx = f->dino_x;
     int ty = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ty--;
-    else if (strcmp(dir, "DOWN") == 0) ty++;
-    else if (strcmp(dir, "LEFT") == 0) tx--;
-    else if (strcmp(dir, "RIGHT") == 0) tx++;
-
     //топология
-    if (tx < 0) tx = f->w - 1;
-    if (tx >= f->w) tx = 0;
-    if (ty < 0) ty = f->h - 1;
-    if (ty >= f->h) ty = 0;
+    step_dir(f, dir, &tx, &ty);
 
-    f->tiles[ty][tx] = '%';
+    set_tile(f, tx, ty, '%');
 }
 
 ///ГОООООРЫ АЛЬПИЙСКИЕ, УССУРИЙСКИЕ, КАВКАВЗСКИЕ, ГООООООРЫЫЫЫЫЫЫЫ
-void mound_dino(struct Field *f, char *dir) {
+void mound_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int tx = f->dino_x;
     int ty = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ty--;
-    else if (strcmp(dir, "DOWN") == 0) ty++;
-    else if (strcmp(dir, "LEFT") == 0) tx--;
-    else if (strcmp(dir, "RIGHT") == 0) tx++;
-
     //топология
-    if (tx < 0) tx = f->w - 1;
-    if (tx >= f->w) tx = 0;
-    if (ty < 0) ty = f->h - 1;
-    if (ty >= f->h) ty = 0;
+    step_dir(f, dir, &tx, &ty);
 
     if (f->tiles[ty][tx] == '%'){
-        f->tiles[ty][tx] = '_';
+        set_tile(f, tx, ty, '_');
     } else {
-        f->tiles[ty][tx] = '^';
+        set_tile(f, tx, ty, '^');
     }
 }
 ///ПРЫГАЕМ ОТСЮДА
-void jump_dino(struct Field *f, char *dir, int jum) {
-    if (!f->has_dino) return;
-
-    int tx = f->dino_x;
-    int ty = f->dino_y;
-    int count = 0;
-
-    
-    if (strcmp(dir, "UP") == 0){ //движение дино вверх
-        for (int i = 0; i < jum; i++){ //дино двигается до размера прыжка или до препятствия
-
-            
-            if (jum == 1 && f->tiles[f->dino_y-1][tx] == '%' && f->dino_y-1 >= 0) { //если яма стоит перед дино и у нас только 1 ход, низя
-                f->dino_y = ty;
-                exit(0);
-            }
-            if (f->dino_y-1 >= 0 && ((jum >= 2) && (i == jum-1)) && f->tiles[f->dino_y-1][tx] == '%'){ //низя в яму
-                f->dino_y = ty;
-                exit(0);
-            }
-
-            if (f->dino_y - i - 1 < 0 && ((f->dino_y == 0) && (i == jum-1)) && f->tiles[f->h-1][tx] == '%'){ //если яма в конце
-                f->dino_y = ty;
-                exit(0);
-            }
-
-
-            
-            if (((f->dino_y + 1) < (f->h-1)) && (f->tiles[f->dino_y + 1][tx] == '^' || f->tiles[f->dino_y + 1][tx] == '&' || f->tiles[f->dino_y + 1][tx] == '@')){ //если по пути нашлась гора, камень или дерево, он встает перед дней
-                if (f->tiles[f->dino_y][tx] == '%'){
-                    f->dino_y = ty;
-                } else {
-                    f->dino_y = f->dino_y;
-                    break;
-                }
-            }  
-            if ((f->tiles[(f->h-1)][tx] == '^' || f->tiles[(f->h-1)][tx] == '&' || f->tiles[(f->h-1)][tx] == '@')&& f->dino_y-1 < 0){ //если гора в конце
-                break;
-            }
-
-            if (ty-i-1 >= 0){ //дино идет вверх до первой строчки включительно
-                f->dino_y = ty-i-1;
-            }
-
-            if (ty-i-1 < 0){ //если дино выходит с противоположной стороны (то есть он идет с последней строки вверх) и по пути нету гор
-                if ((((f->h)-1)-count) >= 0){
-                    f->dino_y = ((f->h)-1)-count;
-                    if (count < (f->h)-1 ){
-                        if (f->tiles[((f->h)-1)-count-1][tx] == '^'){
-                            break;
-                        }
-                    }
-                } 
-                else if ((((f->h)-1-count) < 0)){
-                    count = 0;
-                    f->dino_y = ((f->h)-1)-count;
-                }
-                count++;
-            }
-        }
-    }
-    if (strcmp(dir, "DOWN") == 0){ //движение дино вниз
-        for (int i = 0; i < jum; i++){ //дино двигается до размера прыжка или до препятствия
-            if (jum == 1 && f->tiles[f->dino_y+1][tx] == '%' && f->dino_y+1 <= f->h-1) { //если яма стоит перед дино и у нас только 1 ход, низя
-                f->dino_y = ty;
-                exit(0);
-            }
-            if (f->dino_y+1 <= f->h-1 && ((jum >= 2) && (i == jum-1)) && f->tiles[f->dino_y+1][tx] == '%'){ //низя в яму
-                f->dino_y = ty;
-                exit(0);
-            }
-
-            if (f->dino_y + i + 1 > f->h-1 && ((f->dino_y == f->h-1) && (i == jum-1)) && f->tiles[0][tx] == '%'){ //если яма в конце
-                f->dino_y = ty;
-                exit(0);
-            }
-            
-            if (ty+i+1 < f->h){ //дино идет вниз до последней строчки включительно
-                f->dino_y = ty+i+1;
-            }
-            
-            if (((f->dino_y + 1) < (f->h-1)) && (f->tiles[f->dino_y + 1][tx] == '^' || f->tiles[f->dino_y + 1][tx] == '&' || f->tiles[f->dino_y + 1][tx] == '@')){ //если по пути нашлась гора, камень или дерево, он встает перед дней
-                f->dino_y = f->dino_y;
-                break;
-            }
-            
-            if ((f->tiles[0][tx] == '^' || f->tiles[0][tx] == '&' || f->tiles[0][tx] == '@')&& f->dino_y+1 >= f->h-1){ //если гора в начале
-                break;
-            }
-
-
-
-            if (ty+i+1 > f->h-1){ //если дино выходит с противоположной стороны (то есть он идет с первой строки вниз)
-                if ((count) < f->h){
-                    f->dino_y = count;
-                    if (count < (f->h)-1 ){
-                        if (f->tiles[count+1][tx] == '^'){
-                            break;
-                        }
-                    }
-                } 
-                else if (count > f->h-1){
-                    count = 0;
-                    f->dino_y = count;
-                }
-                count++;
-            }
-        }
+/// дино летит на jum клеток, встаёт перед первой горой/деревом/камнем,
+/// ямы по пути перелетает, но если приземлился в яму — падает
+int jump_dino(struct Field *f, int dir, int jum) {
+    if (!f->has_dino || jum <= 0 || dir == DIR_NONE) return DINO_RUNNING;
+
+    int horiz = dir == DIR_LEFT || dir == DIR_RIGHT;
+    int fwd = dir == DIR_DOWN || dir == DIR_RIGHT;
+
+    // строка для LEFT/RIGHT, столбец для UP/DOWN
+    int n = horiz ? f->w : f->h;
+    int pos = horiz ? f->dino_x : f->dino_y;
+    const uint64_t *bits = horiz
+        ? f->row_block + (size_t)f->dino_y * f->row_words
+        : f->col_block + (size_t)f->dino_x * f->col_words;
+
+    int d = fwd ? block_ahead(bits, n, pos) : block_behind(bits, n, pos);
+    int steps = jum;
+    if (d && d <= jum) {
+        steps = d - 1; // встаём перед препятствием
+        if (f->msg) fprintf(f->msg, "Нельзя перепрыгивать через препятствия!\n");
+        if (f->prof) f->prof->jump_blocked++;
     }
-    if (strcmp(dir, "LEFT") == 0){ // движение дино влево
-        for (int i = 0; i < jum; i++){ // двигаемся до размера прыжка или до горы
+    if (f->prof) f->prof->jump_cells += steps;
+    if (steps == 0) return DINO_RUNNING;
 
-            // низя в яму
-            
+    steps %= n;
+    int np = fwd ? (pos + steps) % n : (pos - steps + n) % n;
+    int nx = horiz ? np : f->dino_x;
+    int ny = horiz ? f->dino_y : np;
 
-            if (jum == 1 && f->tiles[ty][f->dino_x-1] == '%' && f->dino_x-1 >= 0) { //если яма стоит перед дино и у нас только 1 ход, низя
-                f->dino_x = tx;
-                exit(0);
-            }
-            if (f->dino_x-1 >= 0 && ((jum >= 2) && (i == jum-1)) && f->tiles[ty][f->dino_x-1] == '%'){ //низя в яму
-                f->dino_x = tx;
-                exit(0);
-            }
-
-            if (f->dino_x - i - 1 <= 0 && ((f->dino_x == 0) && (i == jum-1)) && f->tiles[ty][f->w-1] == '%'){ //если яма в конце
-                f->dino_y = ty;
-                exit(0);
-            }
-
-            // идем влево
-            if (tx-i-1 >= 0){
-            f->dino_x = tx-i-1;
-            }
-
-            // если по пути гора встать перед ней
-            if (f->dino_x-1 >=0 && (f->tiles[ty][f->dino_x-1] == '^' || f->tiles[ty][f->dino_x-1] == '&' || f->tiles[ty][f->dino_x-1] == '@')){
-                f->dino_x = f->dino_x;
-                break;
-            }
-
-            // гора на правой границе
-            if ((f->tiles[ty][f->w-1] == '^' || f->tiles[ty][f->w-1] == '&' || f->tiles[ty][f->w-1] == '@') && f->dino_x-1 < 0){
-                f->dino_x = 0;
-                break;
-            }
-
-    
-
-            // переход через границу
-            if (tx-i-1 < 0){
-                if (((f->w)-1 - count) >= 0){
-                    f->dino_x = (f->w)-1 - count;
-                    if (count < (f->w)-1 ){
-                        if (f->tiles[ty][(f->w)-1 - count - 1] == '^'){
-                            break;
-                        }
-                    }
-                }
-                else {
-                    count = 0;
-                    f->dino_x = (f->w)-1;
-                }
-                count++;
-            }
-        }
+    // ЯМА НИЗЯЯЯЯ
+    if (f->tiles[ny][nx] == '%') {
+        if (f->prof) f->prof->falls++;
+        return DINO_FELL;
     }
-    if (strcmp(dir, "RIGHT") == 0){ // движение дино вправо
-        for (int i = 0; i < jum; i++){
-
-            // нельзя в яму
-            if (jum == 1 && f->tiles[ty][f->dino_x+1] == '%' && f->dino_x+1 <= f->w-1) { //если яма стоит перед дино и у нас только 1 ход, низя
-                f->dino_x = tx;
-                exit(0);
-            }
-            if (f->dino_x+1 <= f->w-1 && ((jum >= 2) && (i == jum-1)) && f->tiles[ty][f->dino_x+1] == '%'){ //низя в яму
-                f->dino_x = tx;
-                exit(0);
-            }
-
-            if (f->dino_x + i + 1 >= f->w-1 && ((f->dino_x == f->w-1) && (i == jum-1)) && f->tiles[ty][0] == '%'){ //если яма в конце
-                f->dino_y = ty;
-                exit(0);
-            }
-
-
-            // идем вправо
-            if (tx+i+1 < f->w){
-                f->dino_x = tx+i+1;
-            }
-
-            // если по пути гора встать перед ней
-            if (f->dino_x+1 <= f->w-1 && (f->tiles[ty][f->dino_x+1] == '^' || f->tiles[ty][f->dino_x+1] == '&' || f->tiles[ty][f->dino_x+1] == '@')){
-                f->dino_x = f->dino_x;
-                printf("Нельзя перепрыгивать через препятствия!\n");
-                break;
-            }
-
-            // гора на левой границе
-            if ((f->tiles[ty][0] == '^' || f->tiles[ty][0] == '&' || f->tiles[ty][0] == '@') && f->dino_x+1 > f->w-1){
-                f->dino_x = f->w-1;
-                break;
-            }
 
-           
-
-            // переход через границу
-            if (tx+i+1 > (f->w)-1){
-                if ((count) < f->w){
-                    f->dino_x = count;
-                    if (count < (f->w)-1 ){
-                        if (f->tiles[ty][count+1] == '^'){
-                            break;
-                        }
-                    }
-                }
-                else {
-                    count = 0;
-                    f->dino_x = count;
-                }
-                count++;
-            }
-        }
-    }
+    f->dino_x = nx;
+    f->dino_y = ny;
+    return DINO_RUNNING;
 }
 
 
 /// ДЕРЕВО
-void grow_dino(struct Field *f, char *dir) {
+void grow_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int tx = f->dino_x;
     int ty = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ty--;
-    else if (strcmp(dir, "DOWN") == 0) ty++;
-    else if (strcmp(dir, "LEFT") == 0) tx--;
-    else if (strcmp(dir, "RIGHT") == 0) tx++;
-
-    if (tx < 0) tx = f->w - 1;
-    if (tx >= f->w) tx = 0;
-    if (ty < 0) ty = f->h - 1;
-    if (ty >= f->h) ty = 0;
+    step_dir(f, dir, &tx, &ty);
 
-    if (f->tiles[ty][tx] == '_') f->tiles[ty][tx] = '&'; // выросло дерево
+    if (f->tiles[ty][tx] == '_') set_tile(f, tx, ty, '&'); // выросло дерево
 }
 
 // ПОКРАСКА
 void paint_cell(struct Field *f, char color) {
-    if (!f->has_dino) return;
-    f->colors[f->dino_y][f->dino_x] = color;
+    if (!f->has_dino || !is_paint(color)) return;
+    set_color(f, f->dino_x, f->dino_y, color);
 }
 
 
 /// СРУБАЕМ ДЕРЕВО
-void cut_dino(struct Field *f, char *dir) {
+void cut_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int tx = f->dino_x;
     int ty = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ty--;
-    else if (strcmp(dir, "DOWN") == 0) ty++;
-    else if (strcmp(dir, "LEFT") == 0) tx--;
-    else if (strcmp(dir, "RIGHT") == 0) tx++;
-
-    if (tx < 0) tx = f->w - 1;
-    if (tx >= f->w) tx = 0;
-    if (ty < 0) ty = f->h - 1;
-    if (ty >= f->h) ty = 0;
+    step_dir(f, dir, &tx, &ty);
 
-    if (f->tiles[ty][tx] == '&') f->tiles[ty][tx] = '_'; //срубили
+    if (f->tiles[ty][tx] == '&') set_tile(f, tx, ty, '_'); //срубили
 }
 
 /// КАМЕНЬ
-void make_dino(struct Field *f, char *dir) {
+void make_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int tx = f->dino_x;
     int ty = f->dino_y;
 
-    if (strcmp(dir, "UP") == 0) ty--;
-    else if (strcmp(dir, "DOWN") == 0) ty++;
-    else if (strcmp(dir, "LEFT") == 0) tx--;
-    else if (strcmp(dir, "RIGHT") == 0) tx++;
+    step_dir(f, dir, &tx, &ty);
 
-    if (tx < 0) tx = f->w - 1;
-    if (tx >= f->w) tx = 0;
-    if (ty < 0) ty = f->h - 1;
-    if (ty >= f->h) ty = 0;
-
-    if (f->tiles[ty][tx] == '_') f->tiles[ty][tx] = '@'; //вылупился камень и свалился с луны лунтику на голову
+    if (f->tiles[ty][tx] == '_') set_tile(f, tx, ty, '@'); //вылупился камень и свалился с луны лунтику на голову
 }
 
 /// ПИНАЕМ КАМЕНЬ, ДИНО МАГЕЕЕЕЕЕТ
-void push_dino(struct Field *f, char *dir) {
+void push_dino(struct Field *f, int dir) {
     if (!f->has_dino) return;
 
     int sx = f->dino_x;
@@ -439,135 +614,2789 @@ void push_dino(struct Field *f, char *dir) {
     int bx = sx;
     int by = sy;
 
-    if (strcmp(dir, "UP") == 0) by--;
-    else if (strcmp(dir, "DOWN") == 0) by++;
-    else if (strcmp(dir, "LEFT") == 0) bx--;
-    else if (strcmp(dir, "RIGHT") == 0) bx++;
-
-    if (bx < 0) bx = f->w - 1;
-    if (bx >= f->w) bx = 0;
-    if (by < 0) by = f->h - 1;
-    if (by >= f->h) by = 0;
+    step_dir(f, dir, &bx, &by);
 
-    if (f->tiles[by][bx] != '@') return; // рядом камня нет
+    if (f->tiles[by][bx] != '@') { // рядом камня нет
+        if (f->prof) f->prof->push_none++;
+        return;
+    }
 
     //двигаем камень противоположно динозавру
     int nx = bx, ny = by;
-    if (strcmp(dir, "UP") == 0) ny--;
-    else if (strcmp(dir, "DOWN") == 0) ny++;
-    else if (strcmp(dir, "LEFT") == 0) nx--;
-    else if (strcmp(dir, "RIGHT") == 0) nx++;
-
-    if (nx < 0) nx = f->w - 1;
-    if (nx >= f->w) nx = 0;
-    if (ny < 0) ny = f->h - 1;
-    if (ny >= f->h) ny = 0;
+    step_dir(f, dir, &nx, &ny);
 
     // камень не может в гору или в деревоа
-    if (f->tiles[ny][nx] == '^' || f->tiles[ny][nx] == '&' || f->tiles[ny][nx] == '@') return;
+    if (f->tiles[ny][nx] == '^' || f->tiles[ny][nx] == '&' || f->tiles[ny][nx] == '@') {
+        if (f->prof) f->prof->push_blocked++;
+        return;
+    }
 
     // если попал в яму
-    if (f->tiles[ny][nx] == '%') f->tiles[ny][nx] = '_';
-    else f->tiles[ny][nx] = '@'; 
-    f->tiles[by][bx] = '_';
+    if (f->prof) {
+        if (f->tiles[ny][nx] == '%') f->prof->push_pit++;
+        else f->prof->push_moved++;
+    }
+    if (f->tiles[ny][nx] == '%') set_tile(f, nx, ny, '_');
+    else set_tile(f, nx, ny, '@');
+    set_tile(f, bx, by, '_');
 }
 
-    
-///КОМАНДЫЫЫЫЫЫЫЫ
-void Comands_din(char *line, struct Field *f) {
-    char cmd[32];
-    int p = 0;
 
-    if (sscanf(line, "%s%n", cmd, &p) != 1) return;
+///ИДЁМ К ЦЕЛИ
+/// GOTO x y: кратчайший путь шагами MOVE в обход гор, деревьев, камней и ям.
+/// расстояния считаем обходом в ширину от цели (ходы по тору симметричны) и
+/// останавливаемся, как только готовы все слои до дино; обход лежит в кеше и
+/// в следующий раз продолжается с того же места, пока проходимость не поменялась.
+/// путь выходит тот же, что по полному полю: слои всегда достраиваются целиком
+#define PATH_CACHE_SIZE 4
+
+struct PathEntry {
+    int tx, ty, w, h;
+    uint64_t ver;  // pass_ver поля, для которого считали
+    unsigned long used;
+    int *dist;     // w*h шагов до цели: -1 — ещё не дошли (или не дойти), -2 — стена
+    int *queue;
+    long head, tail;
+};
+
+struct PathCache {
+    struct PathEntry e[PATH_CACHE_SIZE];
+    unsigned long clock;
+};
 
-    if (strcmp(cmd, "SIZE") == 0) {
-    int w, h;
+static void free_paths(struct Field *f) {
+    if (!f->paths) return;
+    for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+        free(f->paths->e[i].dist);
+        free(f->paths->e[i].queue);
+    }
+    free(f->paths);
+    f->paths = NULL;
+}
 
-    sscanf(line + p, "%d %d", &w, &h);
+static int passable(const struct Field *f, int x, int y) {
+    char c = f->tiles[y][x];
+    return c != '%' && !is_block(c);
+}
 
-    if (w < 10) w = 10;
-    if (w > 100) w = 100;  ///ограничение на размеры
-    if (h < 10) h = 10;
-    if (h > 100) h = 100;
+static void bfs_start(const struct Field *f, struct PathEntry *e) {
+    int w = f->w;
+    for (int y = 0; y < f->h; y++)
+        for (int x = 0; x < w; x++) e->dist[y * w + x] = passable(f, x, y) ? -1 : -2;
 
-    init_field(f, w, h);
+    e->head = e->tail = 0;
+    if (e->dist[e->ty * w + e->tx] == -2) return; // в цель не встать
+    e->dist[e->ty * w + e->tx] = 0;
+    e->queue[e->tail++] = e->ty * w + e->tx;
 }
 
-    else if (strcmp(cmd, "START") == 0) {
-        int x, y;
-        sscanf(line + p, "%d %d", &x, &y);
-        place_dino(f, x, y);
-    }
-    else if (strcmp(cmd, "MOVE") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        move_dino(f, dir);
+/// раскрываем все клетки слоя level: после этого известны все клетки с расстоянием <= level + 1
+static void bfs_level(const struct Field *f, struct PathEntry *e, int level) {
+    int w = f->w, n = f->w * f->h;
+    int *dist = e->dist;
+
+    while (e->head < e->tail && dist[e->queue[e->head]] == level) {
+        int u = e->queue[e->head++];
+        int y = u / w, x = u - y * w;
+        int nb[4] = {
+            y ? u - w : u + n - w,       // UP
+            y < f->h - 1 ? u + w : x,    // DOWN
+            x ? u - 1 : u + w - 1,       // LEFT
+            x < w - 1 ? u + 1 : u - x,   // RIGHT
+        };
+        for (int k = 0; k < 4; k++) {
+            if (dist[nb[k]] != -1) continue;
+            dist[nb[k]] = level + 1;
+            e->queue[e->tail++] = nb[k];
+        }
     }
-    else if (strcmp(cmd, "PAINT") == 0) {
-        char c;
-        sscanf(line + p, " %c", &c);
-        paint_cell(f, c);
+}
+
+/// запись кеша для цели (tx, ty): найденная или новая вместо самой давней; NULL если нет памяти
+static struct PathEntry *path_entry(struct Field *f, int tx, int ty) {
+    if (!f->paths && !(f->paths = calloc(1, sizeof(struct PathCache)))) return NULL;
+    struct PathCache *pc = f->paths;
+    long n = (long)f->w * f->h;
+
+    struct PathEntry *e = &pc->e[0];
+    for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+        struct PathEntry *c = &pc->e[i];
+        if (c->dist && c->tx == tx && c->ty == ty && c->w == f->w && c->h == f->h && c->ver == f->pass_ver) {
+            c->used = ++pc->clock;
+            return c;
+        }
+        if (c->used < e->used) e = c;
     }
-    else if (strcmp(cmd, "DIG") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        dig_dino(f, dir);
+
+    if (!e->dist || (long)e->w * e->h != n) {
+        int *d = realloc(e->dist, n * sizeof(int));
+        if (d) e->dist = d;
+        int *q = d ? realloc(e->queue, n * sizeof(int)) : NULL;
+        if (!q) {
+            e->used = 0;
+            e->w = e->h = 0; // запись испорчена, пусть пересоздаётся
+            return NULL;
+        }
+        e->queue = q;
     }
-    else if (strcmp(cmd, "MOUND") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        mound_dino(f, dir);
+    e->tx = tx;
+    e->ty = ty;
+    e->w = f->w;
+    e->h = f->h;
+    e->ver = f->pass_ver;
+    e->used = ++pc->clock;
+    bfs_start(f, e);
+    return e;
+}
+
+/// самый близкий к цели сосед (x, y) из уже известных; -1 если такого нет
+static int best_step(struct Field *f, const int *dist, int x, int y, int *bx, int *by) {
+    int best = -1;
+    for (int dir = DIR_UP; dir <= DIR_RIGHT; dir++) {
+        int nx = x, ny = y;
+        step_dir(f, dir, &nx, &ny);
+        int d = dist[ny * f->w + nx];
+        if (d >= 0 && (best < 0 || d < best)) {
+            best = d;
+            *bx = nx;
+            *by = ny;
+        }
     }
-    else if (strcmp(cmd, "JUMP") == 0) {
-        char dir[16];
-        int jum;
-        sscanf(line + p, "%s %d", dir, &jum);
-        jump_dino(f, dir, jum);
+    return best;
+}
+
+/// 1 — дошли, 0 — туда не пройти (дино остаётся на месте)
+int goto_dino(struct Field *f, int x, int y) {
+    if (!f->has_dino || x < 0 || x >= f->w || y < 0 || y >= f->h) return 0;
+    if (f->dino_x == x && f->dino_y == y) return 1;
+
+    struct PathEntry *e = path_entry(f, x, y);
+    if (!e) return 0;
+
+    // достраиваем слои, пока не готов слой ближайшего к цели соседа дино
+    int bx, by;
+    for (;;) {
+        int level = e->head < e->tail ? e->dist[e->queue[e->head]] : -1;
+        int best = best_step(f, e->dist, f->dino_x, f->dino_y, &bx, &by);
+        if (level < 0 || (best >= 0 && best <= level)) break;
+        bfs_level(f, e, level);
     }
-    else if (strcmp(cmd, "GROW") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        grow_dino(f, dir);
+
+    // с первого шага расстояние падает ровно на 1, при равенстве — порядок UP, DOWN, LEFT, RIGHT
+    while (f->dino_x != x || f->dino_y != y) {
+        if (best_step(f, e->dist, f->dino_x, f->dino_y, &bx, &by) < 0) {
+            if (f->msg) fprintf(f->msg, "Туда не пройти!\n");
+            return 0;
+        }
+        f->dino_x = bx;
+        f->dino_y = by;
     }
-    else if (strcmp(cmd, "CUT") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        cut_dino(f, dir);
+    return 1;
+}
+
+
+///ОБЛАСТИ
+/// прямоугольник по тору — это не больше двух отрезков по каждой оси; каждый отрезок
+/// строки — один memset, индекс препятствий правим целыми словами. хеш Зобриста
+/// и история требуют обхода по клеткам, поэтому только когда они включены
+
+/// отрезки [from, from + cnt) внутри 0..n-1 для start, len по кольцу; сколько их
+static int wrap_ranges(int start, int len, int n, int from[2], int cnt[2]) {
+    if (len <= 0 || n <= 0) return 0;
+    if (len > n) len = n;
+    start %= n;
+    if (start < 0) start += n;
+    from[0] = start;
+    cnt[0] = start + len <= n ? len : n - start;
+    if (cnt[0] == len) return 1;
+    from[1] = 0;
+    cnt[1] = len - cnt[0];
+    return 2;
+}
+
+/// биты [from, from + len) в on или в 0
+static void set_bits(uint64_t *bits, int from, int len, int on) {
+    while (len > 0) {
+        int b = from & 63;
+        int k = 64 - b < len ? 64 - b : len;
+        uint64_t mask = (k == 64 ? ~0ULL : ((1ULL << k) - 1)) << b;
+        if (on) bits[from >> 6] |= mask;
+        else bits[from >> 6] &= ~mask;
+        from += k;
+        len -= k;
     }
-    else if (strcmp(cmd, "MAKE") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        make_dino(f, dir);
+}
+
+/// общий обход области: plane 0 — tiles, 1 — colors
+static void fill_plane(struct Field *f, int x, int y, int w, int h, int plane, char c) {
+    int xs[2], xn[2], ys[2], yn[2];
+    if (!f->tiles) return;
+    int nx = wrap_ranges(x, w, f->w, xs, xn);
+    int ny = wrap_ranges(y, h, f->h, ys, yn);
+    if (!nx || !ny) return;
+
+    if (f->log) { // истории нужна каждая клетка: было/стало
+        for (int j = 0; j < ny; j++)
+            for (int yy = ys[j]; yy < ys[j] + yn[j]; yy++)
+                for (int i = 0; i < nx; i++)
+                    for (int xx = xs[i]; xx < xs[i] + xn[i]; xx++)
+                        plane ? set_color(f, xx, yy, c) : set_tile(f, xx, yy, c);
+        return;
     }
-    else if (strcmp(cmd, "PUSH") == 0) {
-        char dir[16];
-        sscanf(line + p, "%s", dir);
-        push_dino(f, dir);
+
+    for (int j = 0; j < ny; j++) {
+        for (int yy = ys[j]; yy < ys[j] + yn[j]; yy++) {
+            char *row = plane ? f->colors[yy] : f->tiles[yy];
+            for (int i = 0; i < nx; i++) {
+                if (f->zon)
+                    for (int xx = xs[i]; xx < xs[i] + xn[i]; xx++)
+                        f->zhash ^= zkey(f, xx, yy, plane, row[xx]) ^ zkey(f, xx, yy, plane, c);
+                memset(row + xs[i], c, xn[i]);
+                if (!plane) set_bits(f->row_block + (size_t)yy * f->row_words, xs[i], xn[i], is_block(c));
+            }
+        }
     }
+    if (plane) return;
+
+    for (int i = 0; i < nx; i++)
+        for (int xx = xs[i]; xx < xs[i] + xn[i]; xx++)
+            for (int j = 0; j < ny; j++)
+                set_bits(f->col_block + (size_t)xx * f->col_words, ys[j], yn[j], is_block(c));
+    f->pass_ver++;
 }
 
+/// препятствие под дино не ставим: его клетка остаётся какой была
+void fill_rect(struct Field *f, int x, int y, int w, int h, char c) {
+    if (!is_tile(c)) return;
+    char under = f->has_dino ? f->tiles[f->dino_y][f->dino_x] : 0;
+    fill_plane(f, x, y, w, h, 0, c);
+    if (f->has_dino && is_block(c) && f->tiles[f->dino_y][f->dino_x] != under)
+        set_tile(f, f->dino_x, f->dino_y, under);
+}
 
-int main(int argn, char *args[]) {
+void paint_rect(struct Field *f, int x, int y, int w, int h, char c) {
+    if (!is_paint(c)) return;
+    fill_plane(f, x, y, w, h, 1, c);
+}
+
+void clear_rect(struct Field *f, int x, int y, int w, int h) {
+    fill_plane(f, x, y, w, h, 0, '_');
+    fill_plane(f, x, y, w, h, 1, ' ');
+}
+
+
+///КОМАНДЫЫЫЫЫЫЫЫ
+/// разбор идёт прямо по тексту программы: строка — это [s, e) без '\n', ничего не копируем
+
+/// пробелы как у isspace в локали "C": ' ' и \t \n \v \f \r
+static int is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static const char *skip_space(const char *s, const char *e) {
+    while (s < e && is_space(*s)) s++;
+    return s;
+}
+
+/// следующее слово [*w, *we), *s — сразу за ним; 0 если до конца строки слов нет
+static int scan_word(const char **s, const char *e, const char **w, const char **we) {
+    const char *p = skip_space(*s, e);
+    *w = p;
+    while (p < e && !is_space(*p)) p++;
+    *we = p;
+    *s = p;
+    return p > *w;
+}
+
+static int word_is(const char *w, const char *we, const char *kw) {
+    size_t n = strlen(kw);
+    return (size_t)(we - w) == n && memcmp(w, kw, n) == 0;
+}
+
+/// как %d у sscanf (пробелы, знак, цифры), только без переполнения — большие числа упираются в INT_MAX/INT_MIN
+static int scan_int(const char **s, const char *e, int *v) {
+    const char *p = skip_space(*s, e);
+    int neg = 0;
+    if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    if (p == e || *p < '0' || *p > '9') return 0;
+
+    long long x = 0;
+    for (; p < e && *p >= '0' && *p <= '9'; p++)
+        if (x <= INT_MAX) x = x * 10 + (*p - '0');
+    if (neg) x = -x;
+    *v = x > INT_MAX ? INT_MAX : x < INT_MIN ? INT_MIN : (int)x;
+    *s = p;
+    return 1;
+}
+
+/// x y w h области; 1 только если прочитались все четыре
+static int scan_rect(const char **s, const char *e, struct Cmd *c) {
+    return scan_int(s, e, &c->a) && scan_int(s, e, &c->b) && scan_int(s, e, &c->w) && scan_int(s, e, &c->h);
+}
+
+/// как " %c": первый непробельный символ
+static int scan_char(const char **s, const char *e, char *c) {
+    const char *p = skip_space(*s, e);
+    if (p == e) return 0;
+    *c = *p;
+    *s = p + 1;
+    return 1;
+}
+
+static int dir_of(const char *w, const char *we) {
+    if (word_is(w, we, "UP")) return DIR_UP;
+    if (word_is(w, we, "DOWN")) return DIR_DOWN;
+    if (word_is(w, we, "LEFT")) return DIR_LEFT;
+    if (word_is(w, we, "RIGHT")) return DIR_RIGHT;
+    return DIR_NONE;
+}
 
+int parse_dir(const char *s) {
+    return dir_of(s, s + strlen(s));
+}
 
-    FILE *file = fopen(args[1], "r");
+/// команда по первому слову строки; OP_NOP если слово незнакомое (компилятор считает это ошибкой).
+/// на больших программах это горячее место: один switch по первой букве и одно-два сравнения
+static int op_of(const char *w, const char *we) {
+#define IS(kw) (we - w == sizeof(kw) - 1 && memcmp(w, kw, sizeof(kw) - 1) == 0)
+    switch (*w) {
+    case 'C':
+        if (IS("CUT")) return OP_CUT;
+        if (IS("CALL")) return OP_CALL;
+        if (IS("CLEAR")) return OP_CLEAR;
+        break;
+    case 'D':
+        if (IS("DIG")) return OP_DIG;
+        if (IS("DEF")) return OP_DEF;
+        break;
+    case 'E': if (IS("END")) return OP_END; break;
+    case 'F': if (IS("FILL")) return OP_FILL; break;
+    case 'G':
+        if (IS("GROW")) return OP_GROW;
+        if (IS("GOTO")) return OP_GOTO;
+        break;
+    case 'J': if (IS("JUMP")) return OP_JUMP; break;
+    case 'L': if (IS("LOAD")) return OP_LOAD; break;
+    case 'M':
+        if (IS("MOVE")) return OP_MOVE;
+        if (IS("MAKE")) return OP_MAKE;
+        if (IS("MOUND")) return OP_MOUND;
+        break;
+    case 'P':
+        if (IS("PUSH")) return OP_PUSH;
+        if (IS("PAINT")) return OP_PAINT;
+        break;
+    case 'R': if (IS("REPEAT")) return OP_REPEAT; break;
+    case 'S':
+        if (IS("SIZE")) return OP_SIZE;
+        if (IS("START")) return OP_START;
+        if (IS("SAVE")) return OP_SAVE;
+        break;
+    }
+    return OP_NOP;
+#undef IS
+}
 
-    struct Field field = {0};
-    char line[256];
+/// ошибка в аргументах: место — первый непробельный символ с s
+static const char *arg_error(const char **at, const char *s, const char *e, const char *msg) {
+    *at = skip_space(s, e);
+    return msg;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        Comands_din(line, &field);
-        print_field(&field);
-        printf("\n");
+/// аргументы команды op из остатка строки [s, e); недописанные числа остаются нулями, как раньше со sscanf.
+/// NULL — разобрали, иначе текст ошибки, а *at — где она в строке
+static const char *parse_args(int op, const char *s, const char *e, struct Cmd *c, const char **at) {
+    const char *d, *de;
+
+    memset(c, 0, sizeof(*c));
+    c->op = (unsigned char)op;
+    switch (op) {
+    case OP_SIZE:
+    case OP_START:
+    case OP_GOTO:
+        if (scan_int(&s, e, &c->a)) scan_int(&s, e, &c->b);
+        break;
+    case OP_FILL:
+        if (!scan_rect(&s, e, c)) return arg_error(at, s, e, "FILL: нужно x y w h и клетка");
+        if (!scan_char(&s, e, &c->c)) return arg_error(at, s, e, "FILL: нет клетки");
+        if (!is_tile(c->c)) return arg_error(at, s - 1, e, "FILL: клетка бывает только _ % ^ & @");
+        break;
+    case OP_CLEAR:
+        if (skip_space(s, e) == e) {
+            c->a = c->b = 0; // без чисел — всё поле
+            c->w = c->h = INT_MAX;
+        } else if (!scan_rect(&s, e, c)) {
+            return arg_error(at, s, e, "CLEAR: нужно x y w h или ничего (всё поле)");
+        }
+        break;
+    case OP_PAINT: {
+        const char *t = s;
+        if (scan_word(&t, e, &d, &de) && word_is(d, de, "RECT")) {
+            c->op = OP_PAINT_RECT;
+            if (!scan_rect(&t, e, c)) return arg_error(at, t, e, "PAINT RECT: нужно x y w h и краска");
+            if (!scan_char(&t, e, &c->c)) return arg_error(at, t, e, "PAINT RECT: нет краски");
+            if (!is_paint(c->c)) return arg_error(at, t - 1, e, "PAINT RECT: краска — видимый символ ASCII");
+        } else {
+            if (!scan_char(&s, e, &c->c)) return arg_error(at, s, e, "PAINT: нет краски");
+            if (!is_paint(c->c)) return arg_error(at, s - 1, e, "PAINT: краска — видимый символ ASCII");
+        }
+        break;
+    }
+    case OP_JUMP:
+    case OP_MOVE: case OP_DIG: case OP_MOUND: case OP_GROW:
+    case OP_CUT: case OP_MAKE: case OP_PUSH:
+        scan_word(&s, e, &d, &de); // d — на слове или в конце строки, если слова нет
+        if ((c->dir = (unsigned char)dir_of(d, de)) == DIR_NONE)
+            return arg_error(at, d, e, "нужно направление UP, DOWN, LEFT или RIGHT");
+        if (op == OP_JUMP) scan_int(&s, e, &c->a);
+        break;
+    default:
+        c->op = OP_NOP; // управление сюда не попадает, его разбирает compile_span
     }
+    return NULL;
+}
+
+/// разбираем строку в команду; 0 — строка пустая, команда незнакомая или с ошибкой (OP_NOP)
+int parse_cmd(const char *line, struct Cmd *c) {
+    const char *s = line, *e = line + strlen(line), *w, *we, *at;
+    int op = scan_word(&s, e, &w, &we) ? op_of(w, we) : OP_NOP; // s — уже за первым словом
+    if (parse_args(op, s, e, c, &at)) c->op = OP_NOP;
+    return c->op != OP_NOP;
+}
+
+/// выполняем одну команду, возвращаем DINO_FELL если дино упал в яму
+int exec_cmd(struct Field *f, const struct Cmd *c) {
+    switch (c->op) {
+    case OP_SIZE: {
+        int w = c->a, h = c->b;
 
-    for (int y = 0; y < field.h; y++) {
-        free(field.tiles[y]);
-        free(field.colors[y]);
+        if (w < 10) w = 10;
+        if (w > 100) w = 100;  ///ограничение на размеры
+        if (h < 10) h = 10;
+        if (h > 100) h = 100;
+
+        init_field(f, w, h);
+        break;
+    }
+    case OP_START: place_dino(f, c->a, c->b); break;
+    case OP_MOVE:  return move_dino(f, c->dir);
+    case OP_PAINT: paint_cell(f, c->c); break;
+    case OP_DIG:   dig_dino(f, c->dir); break;
+    case OP_MOUND: mound_dino(f, c->dir); break;
+    case OP_JUMP:  return jump_dino(f, c->dir, c->a);
+    case OP_GROW:  grow_dino(f, c->dir); break;
+    case OP_CUT:   cut_dino(f, c->dir); break;
+    case OP_MAKE:  make_dino(f, c->dir); break;
+    case OP_PUSH:  push_dino(f, c->dir); break;
+    case OP_GOTO:  goto_dino(f, c->a, c->b); break;
+    case OP_PAINT_RECT: paint_rect(f, c->a, c->b, c->w, c->h, c->c); break;
+    case OP_CLEAR: clear_rect(f, c->a, c->b, c->w, c->h); break;
+    case OP_FILL:
+        fill_rect(f, c->a, c->b, c->w, c->h, c->c);
+        if (f->has_dino && f->tiles[f->dino_y][f->dino_x] == '%') { // залили ямой прямо под дино
+            if (f->prof) f->prof->falls++;
+            return DINO_FELL;
+        }
+        break;
     }
-    free(field.tiles);
-    free(field.colors);
+    return DINO_RUNNING;
+}
 
-    fclose(file);
+/// старый путь: разобрать и сразу выполнить одну строку
+int Comands_din(char *line, struct Field *f) {
+    struct Cmd c;
+    if (!parse_cmd(line, &c)) return DINO_RUNNING;
+    return exec_cmd(f, &c);
+}
+
+
+///ПРОГРАММА
+/// обычная строка — ровно одна команда (даже пустая), чтобы кадры совпадали со строками;
+/// REPEAT n / DEF имя / END / CALL имя превращаются в переходы, а не раскрываются
+
+static int program_error(struct Program *p, long line, long col, const char *msg, const char *name) {
+    p->err_line = line;
+    p->err_col = col;
+    if (name) snprintf(p->err, sizeof(p->err), "%s %s", msg, name);
+    else snprintf(p->err, sizeof(p->err), "%s", msg);
     return 0;
 }
+
+/// "файл:строка:столбец: ошибка", а если ошибка не в тексте программы — perror
+void fprint_program_error(FILE *out, const char *path, const struct Program *p) {
+    if (!p->err_line) perror(path);
+    else if (p->err_col) fprintf(out, "%s:%ld:%ld: %s\n", path, p->err_line, p->err_col, p->err);
+    else fprintf(out, "%s:%ld: %s\n", path, p->err_line, p->err);
+}
+
+/// новая пустая команда в конце программы, NULL если не хватило памяти
+static struct Cmd *emit(struct Program *p) {
+    if (p->n == p->cap) {
+        long cap = p->cap ? p->cap * 2 : 64;
+        struct Cmd *cmds = realloc(p->cmds, cap * sizeof(struct Cmd));
+        if (!cmds) return NULL;
+        p->cmds = cmds;
+        p->cap = cap;
+    }
+    memset(&p->cmds[p->n], 0, sizeof(struct Cmd));
+    return &p->cmds[p->n++];
+}
+
+static int push_block(struct Program *p, long at, long col) {
+    if (p->nblocks == p->block_cap) {
+        long cap = p->block_cap ? p->block_cap * 2 : 16;
+        long *b = realloc(p->blocks, cap * sizeof(long));
+        if (b) p->blocks = b;
+        long *l = b ? realloc(p->block_lines, cap * sizeof(long)) : NULL;
+        if (l) p->block_lines = l;
+        long *c = l ? realloc(p->block_cols, cap * sizeof(long)) : NULL;
+        if (!c) return 0;
+        p->block_cols = c;
+        p->block_cap = cap;
+    }
+    p->blocks[p->nblocks] = at;
+    p->block_lines[p->nblocks] = p->lines;
+    p->block_cols[p->nblocks++] = col;
+    return 1;
+}
+
+/// номер процедуры по имени [name, name + len), заводим новую при первом упоминании; -1 если нет памяти
+static long proc_index(struct Program *p, const char *name, size_t len, long col) {
+    for (long i = 0; i < p->nprocs; i++)
+        if (strlen(p->procs[i].name) == len && memcmp(p->procs[i].name, name, len) == 0) return i;
+
+    if (p->nprocs == p->proc_cap) {
+        long cap = p->proc_cap ? p->proc_cap * 2 : 16;
+        struct Proc *np = realloc(p->procs, cap * sizeof(struct Proc));
+        if (!np) return -1;
+        p->procs = np;
+        p->proc_cap = cap;
+    }
+    struct Proc *pr = &p->procs[p->nprocs];
+    memcpy(pr->name, name, len);
+    pr->name[len] = '\0';
+    pr->at = -1;
+    pr->line = p->lines;
+    pr->col = col;
+    return p->nprocs++;
+}
+
+/// номер пути для SAVE/LOAD (одинаковые пути — один номер); -1 если нет памяти
+static long path_index(struct Program *p, const char *path, size_t len) {
+    for (long i = 0; i < p->npaths; i++)
+        if (strlen(p->paths[i]) == len && memcmp(p->paths[i], path, len) == 0) return i;
+
+    if (p->npaths == p->path_cap) {
+        long cap = p->path_cap ? p->path_cap * 2 : 8;
+        char **np = realloc(p->paths, cap * sizeof(char *));
+        if (!np) return -1;
+        p->paths = np;
+        p->path_cap = cap;
+    }
+    char *s = malloc(len + 1);
+    if (!s) return -1;
+    memcpy(s, path, len);
+    s[len] = '\0';
+    p->paths[p->npaths] = s;
+    return p->npaths++;
+}
+
+/// одна строка [line, e) без '\n'; столбцы в ошибках считаем в байтах с 1
+static int compile_span(struct Program *p, const char *line, const char *e) {
+    const char *rest = line, *w, *we, *name, *name_end;
+    struct Cmd *c;
+
+    p->lines++;
+    if (p->n >= MAX_PROGRAM) // переходы хранятся в int, а строка даёт не больше одной команды
+        return program_error(p, p->lines, 0, "слишком длинная программа", NULL);
+    int op = scan_word(&rest, e, &w, &we) ? op_of(w, we) : OP_NOP; // rest — сразу за первым словом
+    if (op == OP_NOP && we > w) {
+        program_error(p, p->lines, w - line + 1, "", NULL);
+        snprintf(p->err, sizeof(p->err), "незнакомая команда %.*s", (int)(we - w > 32 ? 32 : we - w), w);
+        return 0;
+    }
+    if (op < OP_SAVE) { // действие (они в DinoOp до SAVE) — самый частый случай
+        const char *at, *err;
+        if (!(c = emit(p))) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        if ((err = parse_args(op, rest, e, c, &at))) return program_error(p, p->lines, at - line + 1, err, NULL);
+        return 1;
+    }
+    long col = w - line + 1;
+    long next = skip_space(rest, e) - line + 1; // где ждём то, чего не хватило
+
+    if (op == OP_REPEAT) {
+        int times;
+        const char *t = rest;
+        if (!scan_int(&t, e, &times)) return program_error(p, p->lines, next, "REPEAT без числа", NULL);
+        if (!(c = emit(p))) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        c->op = OP_REPEAT;
+        c->a = times;
+        if (!push_block(p, p->n - 1, col)) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        return 1;
+    }
+    if (op == OP_DEF || op == OP_CALL) {
+        int def = op == OP_DEF;
+        const char *t = rest;
+        if (!scan_word(&t, e, &name, &name_end))
+            return program_error(p, p->lines, next, def ? "DEF без имени" : "CALL без имени", NULL);
+        if (name_end - name >= (long)sizeof(p->procs[0].name))
+            return program_error(p, p->lines, name - line + 1, "слишком длинное имя", NULL);
+        long pi = proc_index(p, name, name_end - name, name - line + 1);
+        if (pi < 0 || !(c = emit(p))) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        if (!def) {
+            c->op = OP_CALL;
+            c->b = (int)pi; // адрес подставит finish_program
+            return 1;
+        }
+        if (p->procs[pi].at >= 0)
+            return program_error(p, p->lines, name - line + 1, "процедура уже есть:", p->procs[pi].name);
+        c->op = OP_DEF;
+        p->procs[pi].at = p->n;
+        if (!push_block(p, p->n - 1, col)) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        return 1;
+    }
+    if (op == OP_END) {
+        if (!p->nblocks) return program_error(p, p->lines, col, "END без REPEAT или DEF", NULL);
+        long at = p->blocks[--p->nblocks];
+
+        if (p->cmds[at].op == OP_REPEAT && p->n == at + 1) {
+            p->n--; // пустой REPEAT выкидываем целиком
+            return 1;
+        }
+        if (!(c = emit(p))) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+        if (p->cmds[at].op == OP_REPEAT) {
+            c->op = OP_END;
+            c->b = (int)at;
+            p->cmds[at].b = (int)(p->n - 1);
+        } else {
+            c->op = OP_RET;
+            p->cmds[at].a = (int)p->n; // DEF перепрыгивает сразу за RET
+        }
+        return 1;
+    }
+    // SAVE и LOAD: путь — весь остаток строки, в нём могут быть пробелы
+    const char *path = rest;
+    while (path < e && (*path == ' ' || *path == '\t')) path++;
+    const char *pe = e;
+    while (pe > path && (pe[-1] == '\r' || pe[-1] == ' ' || pe[-1] == '\t')) pe--;
+    if (pe == path) return program_error(p, p->lines, next, op == OP_SAVE ? "SAVE без файла" : "LOAD без файла", NULL);
+
+    long pi = path_index(p, path, pe - path);
+    if (pi < 0 || !(c = emit(p))) return program_error(p, p->lines, 0, "не хватило памяти", NULL);
+    c->op = (unsigned char)op;
+    c->a = (int)pi;
+    if (op == OP_SAVE) p->saves++;
+    return 1;
+}
+
+int compile_line(struct Program *p, const char *line) {
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\n') len--;
+    return compile_span(p, line, line + len);
+}
+
+/// после последней строки: все блоки закрыты, все CALL знают куда идти
+int finish_program(struct Program *p) {
+    if (p->nblocks)
+        return program_error(p, p->block_lines[p->nblocks - 1], p->block_cols[p->nblocks - 1], "нет END для",
+                             p->cmds[p->blocks[p->nblocks - 1]].op == OP_REPEAT ? "REPEAT" : "DEF");
+    for (long i = 0; i < p->nprocs; i++)
+        if (p->procs[i].at < 0) return program_error(p, p->procs[i].line, p->procs[i].col, "нет DEF для", p->procs[i].name);
+
+    for (long i = 0; i < p->n; i++)
+        if (p->cmds[i].op == OP_CALL) p->cmds[i].a = (int)p->procs[p->cmds[i].b].at;
+
+    free(p->blocks);
+    free(p->block_lines);
+    free(p->block_cols);
+    p->blocks = p->block_lines = p->block_cols = NULL;
+    p->block_cap = 0;
+    return 1;
+}
+
+/// весь текст [text, text + len) построчно, без копий строк
+static int compile_text(struct Program *p, const char *text, size_t len) {
+    const char *s = text, *e = text + len;
+
+    while (s < e) {
+        const char *nl = memchr(s, '\n', e - s);
+        const char *le = nl ? nl : e;
+        if (!compile_span(p, s, le)) return 0;
+        s = le + 1;
+    }
+    return 1;
+}
+
+int compile_program(struct Program *p, const char *text) {
+    return compile_text(p, text, strlen(text)) && finish_program(p);
+}
+
+/// весь поток в один буфер, когда отобразить файл нельзя
+static char *read_all(FILE *file, size_t *len) {
+    size_t cap = 1 << 16, n = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        n += fread(buf + n, 1, cap - n, file);
+        if (n < cap) break;
+        char *nb = realloc(buf, cap * 2);
+        if (!nb) free(buf);
+        buf = nb;
+        cap *= 2;
+    }
+    if (!buf) errno = ENOMEM;
+    else if (ferror(file)) {
+        free(buf);
+        buf = NULL;
+        errno = EIO;
+    }
+    *len = n;
+    return buf;
+}
+
+/// файл программы целиком в память: обычный файл отображается (mmap), остальное
+/// (трубы, /dev/stdin, Windows) дочитывается в буфер. *mapped — как потом освобождать
+#ifdef _WIN32
+static const char *map_text(const char *path, size_t *len, int *mapped) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char *text = read_all(file, len);
+    fclose(file);
+    *mapped = 0;
+    return text;
+}
+#else
+static const char *map_text(const char *path, size_t *len, int *mapped) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    const char *text = NULL;
+    *mapped = 0;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size == 0) {
+        text = "";
+        *len = 0;
+        *mapped = 1;
+    } else if (S_ISREG(st.st_mode)) {
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            posix_madvise(base, st.st_size, POSIX_MADV_SEQUENTIAL); // читаем один раз подряд
+            text = base;
+            *len = (size_t)st.st_size;
+            *mapped = 1;
+        }
+    } else {
+        FILE *file = fdopen(fd, "rb");
+        if (file) {
+            text = read_all(file, len);
+            fclose(file);
+            return text;
+        }
+    }
+    close(fd);
+    return text;
+}
+#endif
+
+static void release_text(const char *text, size_t len, int mapped) {
+#ifndef _WIN32
+    if (mapped) {
+        if (len) munmap((void *)text, len);
+        return;
+    }
+#endif
+    (void)len;
+    (void)mapped;
+    free((void *)text);
+}
+
+int load_program(struct Program *p, const char *path) {
+    size_t len = 0;
+    int mapped;
+    const char *text = map_text(path, &len, &mapped);
+    if (!text) return 0;
+
+    int ok = compile_text(p, text, len) && finish_program(p);
+    release_text(text, len, mapped);
+    return ok;
+}
+
+void free_program(struct Program *p) {
+    free(p->cmds);
+    free(p->loops);
+    free(p->procs);
+    free(p->blocks);
+    free(p->block_lines);
+    free(p->block_cols);
+    for (long i = 0; i < p->npaths; i++) free(p->paths[i]);
+    free(p->paths);
+    memset(p, 0, sizeof(*p));
+}
+
+#define LOOP_MAX_LEN 256
+
+static int is_control(int op) {
+    return op >= OP_REPEAT;
+}
+
+/// сколько раз подряд кусок [i, i+len) повторяется, начиная с i
+static long repeat_count(const struct Program *p, long i, long len) {
+    long k = 1;
+    while (i + (k + 1) * len <= p->n &&
+           memcmp(&p->cmds[i], &p->cmds[i + k * len], len * sizeof(struct Cmd)) == 0)
+        k++;
+    return k;
+}
+
+/// ищем подряд идущие повторы (тело до LOOP_MAX_LEN команд), жадно слева направо;
+/// из вариантов в одной точке берём тот, что покрывает больше команд.
+/// в теле можно CALL (он всегда возвращается следом), остальное управление — нельзя
+int find_loops(struct Program *p) {
+    long cap = 0;
+
+    p->nloops = 0;
+    for (long i = 0; i < p->n; ) {
+        long best_len = 0, best_k = 1;
+        long free_len = 0;
+        while (free_len < LOOP_MAX_LEN && i + free_len < p->n &&
+               (!is_control(p->cmds[i + free_len].op) || p->cmds[i + free_len].op == OP_CALL))
+            free_len++;
+
+        for (long len = 1; len <= free_len && i + 2 * len <= p->n; len++) {
+            if (memcmp(&p->cmds[i], &p->cmds[i + len], sizeof(struct Cmd)) != 0) continue;
+            long k = repeat_count(p, i, len);
+            if (k >= 2 && k * len > best_k * best_len) {
+                best_len = len;
+                best_k = k;
+            }
+        }
+        if (!best_len) { i++; continue; }
+
+        if (p->nloops == cap) {
+            cap = cap ? cap * 2 : 16;
+            struct Loop *l = realloc(p->loops, cap * sizeof(struct Loop));
+            if (!l) return 0;
+            p->loops = l;
+        }
+        p->loops[p->nloops++] = (struct Loop){ i, best_len, best_k };
+        i += best_len * best_k;
+    }
+    return 1;
+}
+
+static const struct Loop *loop_at(const struct Program *p, long pc) {
+    long lo = 0, hi = p->nloops;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (p->loops[mid].start < pc) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < p->nloops && p->loops[lo].start == pc ? &p->loops[lo] : NULL;
+}
+
+
+///ИСТОРИЯ
+/// на каждый шаг — изменённые клетки (было/стало) и где встал дино, раз в every шагов
+/// и после каждого SIZE — полный снимок поля. любой шаг собирается из ближайшего
+/// снимка не больше чем за every шагов, назад по одному шагу — откатом его клеток
+#define HISTORY_EVERY 1024
+
+void init_history(struct History *h, long every) {
+    memset(h, 0, sizeof(*h));
+    h->every = every > 0 ? every : HISTORY_EVERY;
+}
+
+void free_history(struct History *h) {
+    for (long i = 0; i < h->nsnaps; i++) {
+        free(h->snaps[i].tiles);
+        free(h->snaps[i].colors);
+    }
+    free(h->snaps);
+    free(h->recs);
+    free(h->cells);
+    memset(h, 0, sizeof(*h));
+}
+
+/// место под ещё один элемент массива; NULL если не хватило памяти (массив цел)
+static void *grow_array(void *a, long n, long *cap, size_t size) {
+    if (n < *cap) return a;
+    long c = *cap ? *cap * 2 : 256;
+    void *na = realloc(a, c * size);
+    if (na) *cap = c;
+    return na;
+}
+
+static void log_cell(struct History *h, int x, int y, int plane, char old, char now) {
+    if (old == now || h->failed) return;
+
+    struct CellDelta *cells = grow_array(h->cells, h->ncells, &h->cell_cap, sizeof(*cells));
+    if (!cells) { h->failed = 1; return; }
+    h->cells = cells;
+    h->cells[h->ncells++] = (struct CellDelta){ x, y, (char)plane, old, now };
+}
+
+static void take_snap(struct History *h, const struct Field *f, long step) {
+    struct FieldSnap *snaps = grow_array(h->snaps, h->nsnaps, &h->snap_cap, sizeof(*snaps));
+    if (!snaps) { h->failed = 1; return; }
+    h->snaps = snaps;
+
+    struct FieldSnap *sn = &h->snaps[h->nsnaps];
+    memset(sn, 0, sizeof(*sn));
+    sn->step = step;
+    if (f->tiles) {
+        sn->w = f->w;
+        sn->h = f->h;
+        sn->tiles = malloc((size_t)f->w * f->h);
+        sn->colors = malloc((size_t)f->w * f->h);
+        if (!sn->tiles || !sn->colors) {
+            free(sn->tiles);
+            free(sn->colors);
+            h->failed = 1;
+            return;
+        }
+        for (int y = 0; y < f->h; y++) {
+            memcpy(sn->tiles + (size_t)y * f->w, f->tiles[y], f->w);
+            memcpy(sn->colors + (size_t)y * f->w, f->colors[y], f->w);
+        }
+    }
+    h->nsnaps++;
+}
+
+/// запись после очередного шага (или нулевая — до первого)
+static void history_step(struct History *h, const struct Field *f, int reset) {
+    if (h->failed) return;
+
+    struct StepRec *recs = grow_array(h->recs, h->nrecs, &h->rec_cap, sizeof(*recs));
+    if (!recs) { h->failed = 1; return; }
+    h->recs = recs;
+    h->recs[h->nrecs] = (struct StepRec){ h->ncells, f->dino_x, f->dino_y, (char)f->has_dino, (char)reset };
+
+    long step = h->nrecs++;
+    if (reset || step % h->every == 0) take_snap(h, f, step);
+}
+
+/// собрать в f поле из снимка, клетки кладём через set_tile ради индекса и хеша
+static void restore_snap(struct Field *f, const struct FieldSnap *sn) {
+    if (!sn->tiles) {
+        if (f->tiles) free_field(f);
+        f->w = f->h = 0;
+        return;
+    }
+    init_field(f, sn->w, sn->h);
+    for (int y = 0; y < sn->h; y++) {
+        for (int x = 0; x < sn->w; x++) {
+            char t = sn->tiles[(size_t)y * sn->w + x];
+            char c = sn->colors[(size_t)y * sn->w + x];
+            if (t != '_') set_tile(f, x, y, t);
+            if (c != ' ') set_color(f, x, y, c);
+        }
+    }
+}
+
+static void apply_cell(struct Field *f, const struct CellDelta *d, int undo) {
+    char c = undo ? d->old : d->now;
+    if (d->plane) set_color(f, d->x, d->y, c);
+    else set_tile(f, d->x, d->y, c);
+}
+
+static void set_dino(struct Field *f, const struct StepRec *r) {
+    f->dino_x = r->dino_x;
+    f->dino_y = r->dino_y;
+    f->has_dino = r->has_dino;
+}
+
+/// поле после шага step (0 — до первого шага): ближайший снимок + не больше every шагов вперёд
+int seek_field(const struct History *h, long step, struct Field *f) {
+    if (h->failed || step < 0 || step >= h->nrecs) return 0;
+
+    long lo = 0, hi = h->nsnaps;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (h->snaps[mid].step <= step) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return 0;
+    const struct FieldSnap *sn = &h->snaps[lo - 1];
+
+    struct History *log = f->log;
+    f->log = NULL;
+    restore_snap(f, sn);
+    long from = sn->step > 0 ? h->recs[sn->step].cells_end : 0;
+    for (long i = from; i < h->recs[step].cells_end; i++) apply_cell(f, &h->cells[i], 0);
+    set_dino(f, &h->recs[step]);
+    f->log = log;
+    return 1;
+}
+
+/// шаг назад: f — поле после шага *step, станет полем после шага *step - 1
+int step_back_field(const struct History *h, struct Field *f, long *step) {
+    long s = *step;
+    if (h->failed || s <= 0 || s >= h->nrecs) return 0;
+    if (h->recs[s].reset) {
+        if (!seek_field(h, s - 1, f)) return 0;
+    } else {
+        struct History *log = f->log;
+        f->log = NULL;
+        for (long i = h->recs[s].cells_end - 1; i >= h->recs[s - 1].cells_end; i--)
+            apply_cell(f, &h->cells[i], 1);
+        set_dino(f, &h->recs[s - 1]);
+        f->log = log;
+    }
+    *step = s - 1;
+    return 1;
+}
+
+
+///СИМУЛЯЦИЯ
+void init_sim(struct Sim *s, const struct Program *p) {
+    memset(s, 0, sizeof(*s));
+    s->prog = p;
+    s->status = p->n > 0 ? DINO_RUNNING : DINO_FINISHED;
+}
+
+static int push_long(long **a, long *n, long *cap, long v) {
+    if (*n >= DINO_MAX_DEPTH) return 0;
+    if (*n == *cap) {
+        long c = *cap ? *cap * 2 : 16;
+        long *na = realloc(*a, c * sizeof(long));
+        if (!na) return 0;
+        *a = na;
+        *cap = c;
+    }
+    (*a)[(*n)++] = v;
+    return 1;
+}
+
+/// SAVE/LOAD: пути лежат в программе, поэтому не в exec_cmd; неудача — не конец программы
+static void exec_file(struct Sim *s, const struct Cmd *c) {
+    const char *path = s->prog->paths[c->a];
+    int ok = c->op == OP_SAVE ? save_field(&s->field, path) : load_field(&s->field, path);
+    if (!ok && s->field.msg)
+        fprintf(s->field.msg, "Не получилось %s %s\n", c->op == OP_SAVE ? "сохранить" : "загрузить", path);
+}
+
+/// мерить ли время этой команды: случайно, в среднем раз в PROFILE_SAMPLE
+static int prof_sample(struct Profile *p) {
+    uint64_t x = p->rng ? p->rng : 0x9E3779B97F4A7C15ULL; // xorshift64
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    p->rng = x;
+    return (x & (PROFILE_SAMPLE - 1)) == 0;
+}
+
+/// REPEAT/END/DEF/RET/CALL; pc уже указывает за инструкцию
+static void exec_control(struct Sim *s, const struct Cmd *c) {
+    switch (c->op) {
+    case OP_REPEAT:
+        if (c->a <= 0) s->pc = c->b + 1;
+        else if (!push_long(&s->reps, &s->nreps, &s->rep_cap, c->a)) s->status = DINO_ERROR;
+        break;
+    case OP_END:
+        if (--s->reps[s->nreps - 1] > 0) s->pc = c->b + 1;
+        else s->nreps--;
+        break;
+    case OP_DEF:
+        s->pc = c->a;
+        break;
+    case OP_RET:
+        s->pc = s->calls[--s->ncalls];
+        break;
+    case OP_CALL:
+        if (!push_long(&s->calls, &s->ncalls, &s->call_cap, s->pc)) s->status = DINO_ERROR;
+        else s->pc = c->a;
+        break;
+    }
+}
+
+/// одна инструкция (действие или управление); 1 — если это было действие
+static int exec_one(struct Sim *s) {
+    const struct Cmd *c = &s->prog->cmds[s->pc++];
+    int act = 0;
+
+    if (is_control(c->op)) {
+        if (s->field.prof) s->field.prof->count[c->op]++;
+        exec_control(s, c);
+    } else {
+        struct Profile *pf = s->field.prof;
+        uint64_t t0 = pf && prof_sample(pf) ? now_ns() : 0;
+        act = 1;
+        if (s->hist && !s->hist->nrecs) history_step(s->hist, &s->field, 0); // шаг 0
+        s->field.log = s->hist; // и NULL, если историю уже отключили
+        s->steps++;
+        if (c->op == OP_SAVE || c->op == OP_LOAD) exec_file(s, c);
+        else if (exec_cmd(&s->field, c) == DINO_FELL) s->status = DINO_FELL;
+        if (s->hist) history_step(s->hist, &s->field, c->op == OP_SIZE || c->op == OP_LOAD);
+        if (pf) {
+            pf->count[c->op]++;
+            if (t0) {
+                pf->ns[c->op] += (now_ns() - t0) * PROFILE_SAMPLE;
+                pf->sampled[c->op]++;
+            }
+        }
+    }
+    if (s->status == DINO_RUNNING && s->pc >= s->prog->n) s->status = DINO_FINISHED;
+    return act;
+}
+
+/// один шаг программы = одно действие (REPEAT/CALL/... проходятся по пути);
+/// если действий больше нет, шагов не прибавится, а статус станет DINO_FINISHED
+int step_sim(struct Sim *s) {
+    while (s->status == DINO_RUNNING && !exec_one(s)) {}
+    return s->status;
+}
+
+/// обычный прогон: после каждого шага кадр и пустая строка, сообщения туда же.
+/// после падения в яму кадр не рисуется
+void print_frames(struct Sim *s, FILE *out) {
+    s->field.msg = out;
+    while (s->status == DINO_RUNNING) {
+        long before = s->steps;
+        if (step_sim(s) == DINO_FELL) break; // упал в яму — дальше не рисуем
+        if (s->steps == before) break;       // действий больше нет
+        fprint_field(out, &s->field);
+        fprintf(out, "\n");
+    }
+}
+
+/// состояние на границе повтора: хеш поля + где дино
+/// (управление на границах одного и того же повтора всегда одинаковое)
+static uint64_t state_key(const struct Field *f) {
+    uint64_t k = f->zhash ^ ((uint64_t)f->w << 48) ^ ((uint64_t)f->h << 32);
+    if (f->has_dino) k ^= ((uint64_t)f->dino_y << 16 | (uint64_t)f->dino_x) * 0x9E3779B97F4A7C15ULL + 1;
+    return k;
+}
+
+/// точный снимок состояния, чтобы совпадение хешей проверить, а не поверить
+struct StateSnap {
+    int w, h, has_dino, x, y;
+    char *cells; // w*h клеток, потом w*h красок
+};
+
+static int snap_take(struct StateSnap *sn, const struct Field *f) {
+    sn->w = f->w; sn->h = f->h;
+    sn->has_dino = f->has_dino; sn->x = f->dino_x; sn->y = f->dino_y;
+    sn->cells = malloc((size_t)2 * f->w * f->h + 1);
+    if (!sn->cells) return 0;
+    for (int y = 0; y < f->h; y++) {
+        memcpy(sn->cells + (size_t)y * f->w, f->tiles[y], f->w);
+        memcpy(sn->cells + (size_t)(f->h + y) * f->w, f->colors[y], f->w);
+    }
+    return 1;
+}
+
+static int snap_same(const struct StateSnap *sn, const struct Field *f) {
+    if (sn->w != f->w || sn->h != f->h || sn->has_dino != f->has_dino) return 0;
+    if (f->has_dino && (sn->x != f->dino_x || sn->y != f->dino_y)) return 0;
+    for (int y = 0; y < f->h; y++) {
+        if (memcmp(sn->cells + (size_t)y * f->w, f->tiles[y], f->w) != 0) return 0;
+        if (memcmp(sn->cells + (size_t)(f->h + y) * f->w, f->colors[y], f->w) != 0) return 0;
+    }
+    return 1;
+}
+
+#define CYCLE_TABLE_MAX (1 << 16)
+#define LOOP_NEST_MAX 16
+
+/// хеш-таблица "состояние -> номер прохода", растёт по мере надобности
+struct SeenTable {
+    uint64_t *keys;
+    long *iters;
+    long size, used;
+};
+
+static int seen_grow(struct SeenTable *t) {
+    long size = t->size ? t->size * 2 : 64;
+    uint64_t *keys = malloc(size * sizeof(uint64_t));
+    long *iters = malloc(size * sizeof(long));
+    if (!keys || !iters) { free(keys); free(iters); return 0; }
+    for (long i = 0; i < size; i++) iters[i] = -1;
+
+    for (long i = 0; i < t->size; i++) {
+        if (t->iters[i] < 0) continue;
+        long h = (long)(t->keys[i] & (size - 1));
+        while (iters[h] >= 0) h = (h + 1) & (size - 1);
+        keys[h] = t->keys[i];
+        iters[h] = t->iters[i];
+    }
+    free(t->keys);
+    free(t->iters);
+    t->keys = keys;
+    t->iters = iters;
+    t->size = size;
+    return 1;
+}
+
+/// прошлый проход с таким же ключом (-1 если не было), запоминаем текущий
+static long seen_check(struct SeenTable *t, uint64_t key, long it) {
+    if (t->used >= t->size / 2 && t->size < CYCLE_TABLE_MAX) seen_grow(t);
+    if (!t->size) return -1;
+
+    long h = (long)(key & (t->size - 1));
+    while (t->iters[h] >= 0 && t->keys[h] != key) h = (h + 1) & (t->size - 1);
+    long prev = t->iters[h];
+    if (prev >= 0 || t->used < t->size / 2) {
+        if (prev < 0) t->used++;
+        t->keys[h] = key;
+        t->iters[h] = it;
+    }
+    return prev;
+}
+
+static void run_loop(struct Sim *s, long at, const struct Loop *lp, long *budget, int nest);
+
+/// одна инструкция в режиме циклов: если с неё начинается повтор — весь повтор разом
+static void exec_fast(struct Sim *s, long *budget, int nest) {
+    const struct Cmd *c = &s->prog->cmds[s->pc];
+
+    if (nest < LOOP_NEST_MAX && s->field.zon && !s->hist && !s->prog->saves) { // с историей и SAVE каждый шаг честный
+        if (c->op == OP_REPEAT && c->a >= 2) {
+            run_loop(s, s->pc, NULL, budget, nest + 1);
+            return;
+        }
+        const struct Loop *lp = loop_at(s->prog, s->pc);
+        if (lp) {
+            run_loop(s, s->pc, lp, budget, nest + 1);
+            return;
+        }
+    }
+    if (exec_one(s) && *budget > 0) (*budget)--;
+}
+
+/// выполняем повтор проход за проходом: REPEAT по адресу at или плоский повтор lp.
+/// на каждой границе смотрим хеш состояния, при совпадении с проходом j проверяем
+/// период честным прогоном и проматываем оставшиеся целые периоды, остаток
+/// добиваем обычными шагами. управление не зависит от поля, поэтому число
+/// действий за период одно и то же
+static void run_loop(struct Sim *s, long at, const struct Loop *lp, long *budget, int nest) {
+    struct Field *f = &s->field;
+    long count, body, ld;
+    long cd = s->ncalls;
+
+    if (lp) {
+        count = lp->count;
+        body = lp->start;
+        ld = s->nreps;
+    } else {
+        count = s->prog->cmds[at].a;
+        exec_one(s); // сам OP_REPEAT: заводим счётчик
+        if (s->status != DINO_RUNNING) return;
+        body = at + 1;
+        ld = s->nreps; // наш счётчик — s->reps[ld - 1]
+    }
+
+    struct SeenTable seen = {0};
+    struct StateSnap snap = {0};
+    long verify_at = -1, period = 0, snap_steps = 0;
+    int done = 0;
+
+    for (long it = 0; ; ) {
+        // стоим на границе прохода it
+        if (!done && verify_at == it) {
+            if (snap_same(&snap, f)) {
+                long per = s->steps - snap_steps; // действий за период
+                // последний проход всегда честный: тогда и конец повтора, и остановка
+                // по бюджету ровно такие же, как без промотки
+                long periods = (count - 1 - it) / period;
+                if (*budget >= 0 && per > 0 && periods > *budget / per) periods = *budget / per;
+
+                if (lp) s->pc += periods * period * lp->len;
+                else s->reps[ld - 1] -= periods * period;
+                it += periods * period;
+                s->steps += periods * per;
+                s->skipped += periods * per;
+                if (*budget > 0) *budget -= periods * per;
+                done = 1;
+            }
+            free(snap.cells);
+            snap.cells = NULL;
+            verify_at = -1;
+            if (*budget == 0) break; // промотка выбрала весь бюджет — проход уже лишний
+        } else if (!done && verify_at < 0) {
+            long prev = seen_check(&seen, state_key(f), it);
+            if (prev >= 0 && snap_take(&snap, f)) {
+                period = it - prev;
+                snap_steps = s->steps;
+                verify_at = it + period;
+            }
+        }
+
+        // один проход
+        long target = lp ? body + (it + 1) * lp->len : body;
+        for (;;) {
+            exec_fast(s, budget, nest);
+            if (s->status != DINO_RUNNING || *budget == 0) break;
+            if (s->ncalls != cd) continue;
+            if (!lp && s->nreps < ld) break;               // REPEAT кончился
+            if (s->nreps == ld && s->pc == target) break;  // граница следующего прохода
+        }
+        it++;
+        if (s->status != DINO_RUNNING || *budget == 0) break;
+        if (lp ? it >= count : s->nreps < ld) break;
+    }
+    free(snap.cells);
+    free(seen.keys);
+    free(seen.iters);
+}
+
+/// гоняем до конца, до ямы или до max_steps шагов (max_steps < 0 — без ограничения)
+int run_sim(struct Sim *s, long max_steps) {
+    while (s->status == DINO_RUNNING && max_steps != 0) {
+        if (s->cycles) {
+            exec_fast(s, &max_steps, 0);
+        } else {
+            step_sim(s);
+            if (max_steps > 0) max_steps--;
+        }
+    }
+    return s->status;
+}
+
+/// отключаем историю (её можно освобождать); дальше шаги идут без неё
+void detach_history(struct Sim *s) {
+    s->hist = NULL;
+    s->field.log = NULL;
+}
+
+void free_sim(struct Sim *s) {
+    if (s->field.tiles) free_field(&s->field);
+    free(s->calls);
+    free(s->reps);
+    s->calls = s->reps = NULL;
+    s->ncalls = s->nreps = s->call_cap = s->rep_cap = 0;
+}
+
+/// FNV-1a по размерам, клеткам и краскам — отпечаток итогового поля
+uint64_t hash_field(const struct Field *f) {
+    uint64_t h = 1469598103934665603ULL;
+    int dims[2] = { f->w, f->h };
+    const unsigned char *d = (const unsigned char *)dims;
+
+    for (size_t i = 0; i < sizeof(dims); i++) h = (h ^ d[i]) * 1099511628211ULL;
+    if (!f->tiles) return h;
+    for (int y = 0; y < f->h; y++) {
+        for (int x = 0; x < f->w; x++) h = (h ^ (unsigned char)f->tiles[y][x]) * 1099511628211ULL;
+        for (int x = 0; x < f->w; x++) h = (h ^ (unsigned char)f->colors[y][x]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+
+///ПРОФИЛЬ
+uint64_t now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / freq.QuadPart * 1000000000ULL
+                      + t.QuadPart % freq.QuadPart * 1000000000ULL / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+const char *op_name(int op) {
+    static const char *names[OP_COUNT] = {
+        [OP_NOP] = "NOP", [OP_SIZE] = "SIZE", [OP_START] = "START", [OP_MOVE] = "MOVE",
+        [OP_PAINT] = "PAINT", [OP_DIG] = "DIG", [OP_MOUND] = "MOUND", [OP_JUMP] = "JUMP",
+        [OP_GROW] = "GROW", [OP_CUT] = "CUT", [OP_MAKE] = "MAKE", [OP_PUSH] = "PUSH",
+        [OP_GOTO] = "GOTO", [OP_FILL] = "FILL", [OP_PAINT_RECT] = "PAINT RECT", [OP_CLEAR] = "CLEAR",
+        [OP_SAVE] = "SAVE", [OP_LOAD] = "LOAD", [OP_REPEAT] = "REPEAT", [OP_END] = "END",
+        [OP_DEF] = "DEF", [OP_RET] = "RET", [OP_CALL] = "CALL",
+    };
+    return op >= 0 && op < OP_COUNT && names[op] ? names[op] : "?";
+}
+
+/// отчёт: команды по убыванию времени, потом счётчики; json — одной строкой для скриптов
+void fprint_profile(FILE *out, const struct Profile *p, int json) {
+    int order[OP_COUNT], n = 0;
+    uint64_t total = 0;
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (!p->count[op]) continue;
+        int k = n++;
+        while (k > 0 && (p->ns[order[k - 1]] < p->ns[op] ||
+                         (p->ns[order[k - 1]] == p->ns[op] && p->count[order[k - 1]] < p->count[op]))) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = op;
+        total += p->ns[op];
+    }
+
+    if (json) {
+        fprintf(out, "{\"commands\":[");
+        for (int i = 0; i < n; i++)
+            fprintf(out, "%s{\"op\":\"%s\",\"count\":%llu,\"ns\":%llu,\"sampled\":%llu}", i ? "," : "",
+                    op_name(order[i]), (unsigned long long)p->count[order[i]],
+                    (unsigned long long)p->ns[order[i]], (unsigned long long)p->sampled[order[i]]);
+        fprintf(out, "],\"parse_ns\":%llu,\"parse_lines\":%llu,\"frames\":%llu,\"render_bytes\":%llu,"
+                     "\"render_ns\":%llu,\"jump_cells\":%llu,\"jump_blocked\":%llu,\"move_blocked\":%llu,"
+                     "\"falls\":%llu,\"push_none\":%llu,\"push_blocked\":%llu,\"push_pit\":%llu,"
+                     "\"push_moved\":%llu,\"skipped\":%llu}\n",
+                (unsigned long long)p->parse_ns, (unsigned long long)p->parse_lines,
+                (unsigned long long)p->frames, (unsigned long long)p->render_bytes,
+                (unsigned long long)p->render_ns, (unsigned long long)p->jump_cells,
+                (unsigned long long)p->jump_blocked, (unsigned long long)p->move_blocked,
+                (unsigned long long)p->falls, (unsigned long long)p->push_none,
+                (unsigned long long)p->push_blocked, (unsigned long long)p->push_pit,
+                (unsigned long long)p->push_moved, (unsigned long long)p->skipped);
+        return;
+    }
+
+    fputs("команда               раз           мс     нс/раз    доля\n", out); // printf считает байты, а не буквы
+    for (int i = 0; i < n; i++) {
+        int op = order[i];
+        fprintf(out, "%-12s %12llu %12.3f %10.1f %6.1f%%\n", op_name(op), (unsigned long long)p->count[op],
+                p->ns[op] / 1e6, (double)p->ns[op] / p->count[op], total ? 100.0 * p->ns[op] / total : 0.0);
+    }
+    fprintf(out, "разбор:   %llu строк, %.3f мс\n", (unsigned long long)p->parse_lines, p->parse_ns / 1e6);
+    fprintf(out, "вывод:    %llu кадров, %llu байт, %.3f мс\n", (unsigned long long)p->frames,
+            (unsigned long long)p->render_bytes, p->render_ns / 1e6);
+    fprintf(out, "прыжки:   %llu клеток пролетели, %llu раз упёрлись\n",
+            (unsigned long long)p->jump_cells, (unsigned long long)p->jump_blocked);
+    fprintf(out, "ходы:     %llu раз упёрлись, %llu раз упали в яму\n",
+            (unsigned long long)p->move_blocked, (unsigned long long)p->falls);
+    fprintf(out, "толкания: %llu без камня, %llu упёрлись, %llu в яму, %llu сдвинули\n",
+            (unsigned long long)p->push_none, (unsigned long long)p->push_blocked,
+            (unsigned long long)p->push_pit, (unsigned long long)p->push_moved);
+    if (p->skipped) fprintf(out, "промотано: %llu шагов\n", (unsigned long long)p->skipped);
+}
+
+
+///ТРАССА КАДРОВ
+/// файл: "DINOTRC\0", версия, TRACE_BLOCK, потом блоки Хаффмана (huff_write_block из huffman_lab2.c).
+/// поток внутри блоков — записи по шагу: varint длины сообщений и сами сообщения,
+/// затем varint (длина кадра + 1) или 0, если кадра нет (упал в яму). байты кадра —
+/// XOR с прошлым кадром, где любой ряд нулей записан как 0 и varint его длины
+#define TRACE_MAGIC "DINOTRC"
+#define TRACE_VERSION 3
+
+int open_trace(struct Trace *t, const char *path, int writing) {
+    memset(t, 0, sizeof(*t));
+    t->writing = writing;
+    t->block = malloc(TRACE_BLOCK);
+    if (!t->block) return 0;
+    t->f = fopen(path, writing ? "wb" : "rb");
+    if (!t->f) {
+        free(t->block);
+        return 0;
+    }
+
+    char magic[8] = TRACE_MAGIC;
+    if (writing) {
+        fwrite(magic, 1, sizeof(magic), t->f);
+        write_u64_le(t->f, TRACE_VERSION);
+        write_u64_le(t->f, TRACE_BLOCK);
+        return !ferror(t->f);
+    }
+    char got[8];
+    if (fread(got, 1, sizeof(got), t->f) != sizeof(got) || memcmp(got, magic, sizeof(magic)) != 0 ||
+        read_u64_le(t->f) != TRACE_VERSION || read_u64_le(t->f) != TRACE_BLOCK) {
+        fclose(t->f);
+        free(t->block);
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+static void trace_put(struct Trace *t, unsigned char b) {
+    t->block[t->block_len++] = b;
+    if (t->block_len == TRACE_BLOCK) {
+        if (!huff_write_block(t->f, t->block, t->block_len)) t->failed = 1;
+        t->block_len = 0;
+    }
+}
+
+static void trace_varint(struct Trace *t, uint64_t v) {
+    while (v >= 0x80) {
+        trace_put(t, (unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    trace_put(t, (unsigned char)v);
+}
+
+/// свой буфер под кадр нужного размера; 0 если не хватило памяти
+static int trace_reserve(unsigned char **buf, size_t *cap, size_t len) {
+    if (len <= *cap) return 1;
+    unsigned char *b = realloc(*buf, len);
+    if (!b) return 0;
+    *buf = b;
+    *cap = len;
+    return 1;
+}
+
+static void trace_swap(struct Trace *t, size_t len) {
+    unsigned char *b = t->prev;
+    size_t cap = t->prev_cap;
+    t->prev = t->frame;
+    t->prev_cap = t->frame_cap;
+    t->frame = b;
+    t->frame_cap = cap;
+    t->prev_len = len;
+}
+
+/// запись шага: сообщения msg (msg_len байт) и кадр поля f; f == NULL — кадра нет
+int trace_frame(struct Trace *t, const struct Field *f, const char *msg, size_t msg_len) {
+    trace_varint(t, msg_len);
+    for (size_t i = 0; i < msg_len; i++) trace_put(t, (unsigned char)msg[i]);
+    t->raw_bytes += msg_len;
+    if (!f) {
+        trace_varint(t, 0);
+        return !t->failed;
+    }
+
+    size_t len = f->tiles ? (size_t)(f->w + 1) * f->h : 0;
+    if (!trace_reserve(&t->frame, &t->frame_cap, len ? len : 1)) return 0;
+    render_field(f, (char *)t->frame);
+
+    trace_varint(t, (uint64_t)len + 1);
+    for (size_t i = 0; i < len; ) {
+        unsigned char x = t->frame[i] ^ (i < t->prev_len ? t->prev[i] : 0);
+        if (x) {
+            trace_put(t, x);
+            i++;
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < len && t->frame[j] == (j < t->prev_len ? t->prev[j] : 0)) j++;
+        trace_put(t, 0);
+        trace_varint(t, j - i);
+        i = j;
+    }
+    trace_swap(t, len);
+    t->frames++;
+    t->raw_bytes += len + 1; // с пустой строкой после кадра
+    return !t->failed;
+}
+
+/// следующий байт потока, -1 — кончился или блок испорчен
+static int trace_get(struct Trace *t) {
+    if (t->block_pos == t->block_len) {
+        long long n = huff_read_block(t->f, t->block, TRACE_BLOCK);
+        if (n <= 0) {
+            if (n < 0) t->failed = 1;
+            return -1;
+        }
+        t->block_len = (size_t)n;
+        t->block_pos = 0;
+    }
+    return t->block[t->block_pos++];
+}
+
+static int trace_get_varint(struct Trace *t, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = trace_get(t);
+        if (b < 0) return 0;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0;
+}
+
+/// 1 — шаг прочитан: сообщения в *msg, кадр в *frame (NULL если его нет; всё живёт
+/// до следующего вызова), 0 — записи кончились, -1 — файл испорчен
+int read_frame(struct Trace *t, const char **msg, size_t *msg_len, const char **frame, size_t *len) {
+    uint64_t m, n;
+    if (!trace_get_varint(t, &m)) return t->failed || t->block_pos != t->block_len ? -1 : 0;
+    if (m > ((uint64_t)1 << 40) || !trace_reserve(&t->msg, &t->msg_cap, m ? m : 1)) return -1;
+    for (uint64_t i = 0; i < m; i++) {
+        int b = trace_get(t);
+        if (b < 0) return -1;
+        t->msg[i] = (unsigned char)b;
+    }
+    *msg = (const char *)t->msg;
+    *msg_len = m;
+    t->raw_bytes += m;
+
+    if (!trace_get_varint(t, &n) || n > ((uint64_t)1 << 40)) return -1;
+    if (n-- == 0) {
+        *frame = NULL;
+        *len = 0;
+        return 1;
+    }
+    if (!trace_reserve(&t->frame, &t->frame_cap, n ? n : 1)) return -1;
+    for (uint64_t i = 0; i < n; ) {
+        int b = trace_get(t);
+        if (b < 0) return -1;
+        if (b) {
+            t->frame[i] = (unsigned char)b ^ (i < t->prev_len ? t->prev[i] : 0);
+            i++;
+            continue;
+        }
+        uint64_t run;
+        if (!trace_get_varint(t, &run) || run == 0 || run > n - i) return -1;
+        for (uint64_t k = 0; k < run; k++, i++) t->frame[i] = i < t->prev_len ? t->prev[i] : 0;
+    }
+    trace_swap(t, n);
+    t->frames++;
+    t->raw_bytes += n + 1;
+    *frame = (const char *)t->prev;
+    *len = n;
+    return 1;
+}
+
+/// при записи дописывает последний неполный блок; 0 если что-то не записалось
+int close_trace(struct Trace *t) {
+    int ok = !t->failed;
+    if (t->writing && t->block_len && !huff_write_block(t->f, t->block, t->block_len)) ok = 0;
+    if (t->f && fclose(t->f) != 0 && t->writing) ok = 0;
+    free(t->block);
+    free(t->prev);
+    free(t->frame);
+    free(t->msg);
+    t->f = NULL;
+    t->block = t->prev = t->frame = t->msg = NULL;
+    return ok;
+}
+
+/// сколько сообщений набралось в msg с прошлого раза: в *buf, а msg — снова с начала
+static size_t take_messages(FILE *msg, unsigned char **buf, size_t *cap) {
+    long n = ftell(msg);
+    if (n <= 0 || !trace_reserve(buf, cap, (size_t)n)) return 0;
+    rewind(msg);
+    size_t got = fread(*buf, 1, (size_t)n, msg);
+    rewind(msg);
+    return got;
+}
+
+/// как print_frames, только кадры и сообщения уходят в трассу; 0 если запись не удалась
+int record_frames(struct Sim *s, struct Trace *t) {
+    FILE *msg = tmpfile();
+    if (!msg) return 0;
+
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    int ok = 1;
+    s->field.msg = msg;
+    while (ok && s->status == DINO_RUNNING) {
+        long before = s->steps;
+        int st = step_sim(s);
+        size_t n = take_messages(msg, &buf, &cap);
+        if (st == DINO_FELL || s->steps == before) { // кадра нет, но сообщения этого шага были
+            if (n) ok = trace_frame(t, NULL, (const char *)buf, n);
+            break;
+        }
+        ok = trace_frame(t, &s->field, (const char *)buf, n);
+    }
+    s->field.msg = NULL;
+    fclose(msg);
+    free(buf);
+    return ok && !t->failed;
+}
+
+/// печатает трассу в out так же, как её печатал обычный прогон; 0 — всё, -1 — трасса испорчена
+int replay_frames(struct Trace *t, FILE *out) {
+    const char *msg, *frame;
+    size_t msg_len, len;
+    int r;
+    while ((r = read_frame(t, &msg, &msg_len, &frame, &len)) == 1) {
+        fwrite(msg, 1, msg_len, out);
+        if (!frame) continue;
+        fwrite(frame, 1, len, out);
+        putc('\n', out);
+    }
+    return r;
+}
+
+
+///ГЕНЕРАТОР ПРОГРАММ
+enum { GEN_MOVE, GEN_JUMP, GEN_PUSH, GEN_MAKE, GEN_DIG, GEN_GROW, GEN_CUT, GEN_PAINT, GEN_KINDS };
+
+/// веса команд в процентах для каждого GenMix
+static const int gen_weights[MIX_COUNT][GEN_KINDS] = {
+    [MIX_MIXED] = { 30, 15, 10, 10, 5, 10, 10, 10 },
+    [MIX_JUMP]  = { 20, 60,  0, 10, 0,  5,  5,  0 },
+    [MIX_PUSH]  = { 20,  5, 40, 25, 0,  0,  5,  5 },
+    [MIX_PAINT] = { 30,  5,  0,  0, 0,  0,  0, 65 },
+};
+
+static const char *gen_mix_names[MIX_COUNT] = { "mixed", "jump", "push", "paint" };
+
+int gen_mix(const char *name) {
+    for (int m = 0; m < MIX_COUNT; m++)
+        if (strcmp(name, gen_mix_names[m]) == 0) return m;
+    return -1;
+}
+
+const char *gen_mix_name(int mix) {
+    return mix >= 0 && mix < MIX_COUNT ? gen_mix_names[mix] : "?";
+}
+
+/// splitmix64: свой генератор, чтобы программа не зависела от rand() платформы
+static uint64_t gen_next(struct Gen *g) {
+    uint64_t z = (g->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void init_gen(struct Gen *g, const struct GenOpts *o) {
+    memset(g, 0, sizeof(*g));
+    g->o = *o;
+    if (g->o.mix < 0 || g->o.mix >= MIX_COUNT) g->o.mix = MIX_MIXED;
+    g->rng = o->seed;
+}
+
+/// следующая строка программы в buf; 0 когда программа кончилась
+int gen_line(struct Gen *g, char *buf, size_t n) {
+    static const char *dirs[] = { "UP", "DOWN", "LEFT", "RIGHT" };
+    long i = g->line++;
+
+    if (i == 0) {
+        snprintf(buf, n, "SIZE %d %d", g->o.w, g->o.h);
+        return 1;
+    }
+    int w = g->o.w < 10 ? 10 : g->o.w > 100 ? 100 : g->o.w;
+    int h = g->o.h < 10 ? 10 : g->o.h > 100 ? 100 : g->o.h;
+    if (i == 1) {
+        snprintf(buf, n, "START %d %d", w / 2, h / 2);
+        return 1;
+    }
+    if (i >= g->o.len + 2) return 0;
+
+    uint64_t r = gen_next(g);
+    const char *dir = dirs[r & 3];
+    if (g->pending_mound) {
+        snprintf(buf, n, "MOUND %s", dirs[g->pending_mound - 1]);
+        g->pending_mound = 0;
+        return 1;
+    }
+
+    int pick = (int)((r >> 2) % 100), kind = 0;
+    while (kind < GEN_KINDS - 1 && pick >= gen_weights[g->o.mix][kind]) pick -= gen_weights[g->o.mix][kind++];
+    if (kind == GEN_DIG && i + 1 >= g->o.len + 2) kind = GEN_MOVE; // на MOUND места не осталось
+
+    switch (kind) {
+    case GEN_MOVE:  snprintf(buf, n, "MOVE %s", dir); break;
+    case GEN_JUMP:  snprintf(buf, n, "JUMP %s %d", dir, 1 + (int)((r >> 16) % (w > h ? w : h))); break;
+    case GEN_PUSH:  snprintf(buf, n, "PUSH %s", dir); break;
+    case GEN_MAKE:  snprintf(buf, n, "MAKE %s", dir); break;
+    case GEN_GROW:  snprintf(buf, n, "GROW %s", dir); break;
+    case GEN_CUT:   snprintf(buf, n, "CUT %s", dir); break;
+    case GEN_PAINT: snprintf(buf, n, "PAINT %c", "RGBY"[(r >> 16) & 3]); break;
+    case GEN_DIG:
+        snprintf(buf, n, "DIG %s", dir);
+        g->pending_mound = (int)(r & 3) + 1;
+        break;
+    }
+    return 1;
+}
+
+
+///ТОЛПА ДИНО
+/// что агент хочет сделать в этом тике: встать в (tx, ty) и/или поменять до двух клеток
+struct AgentPlan {
+    int act;          // было действие (иначе программа кончилась)
+    int moves, fell;
+    int tx, ty;
+    int ncells;
+    int cx[2], cy[2];
+    char plane[2];    // 0 — tiles, 1 — colors
+    char val[2];
+};
+
+void init_crowd(struct Crowd *c, int threads) {
+    memset(c, 0, sizeof(*c));
+    c->threads = threads > 0 ? threads : 1;
+}
+
+void free_crowd(struct Crowd *c) {
+    for (int i = 0; i < c->n; i++) free_sim(&c->agents[i]);
+    free(c->agents);
+    free(c->occ);
+    free(c->claim);
+    free(c->plans);
+    if (c->field.tiles) free_field(&c->field);
+    memset(c, 0, sizeof(*c));
+}
+
+/// новый агент в свободной клетке (x, y); поле должно быть уже готово
+int add_agent(struct Crowd *c, const struct Program *p, int x, int y) {
+    struct Field *f = &c->field;
+    if (!f->tiles || x < 0 || x >= f->w || y < 0 || y >= f->h) return 0;
+
+    if (!c->occ) {
+        c->occ = calloc((size_t)f->w * f->h, sizeof(int));
+        c->claim = malloc((size_t)f->w * f->h * sizeof(int));
+        if (!c->occ || !c->claim) return 0;
+        for (long i = 0; i < (long)f->w * f->h; i++) c->claim[i] = -1;
+    }
+    if (c->occ[(size_t)y * f->w + x]) return 0;
+
+    if (c->n == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 64;
+        struct Sim *a = realloc(c->agents, cap * sizeof(struct Sim));
+        struct AgentPlan *pl = a ? realloc(c->plans, cap * sizeof(struct AgentPlan)) : NULL;
+        if (a) c->agents = a;
+        if (!pl) return 0;
+        c->plans = pl;
+        c->cap = cap;
+    }
+    struct Sim *s = &c->agents[c->n];
+    init_sim(s, p);
+    s->field.dino_x = x; // клеток у агента нет, только координаты
+    s->field.dino_y = y;
+    s->field.has_dino = 1;
+    c->occ[(size_t)y * f->w + x] = ++c->n;
+    return 1;
+}
+
+/// пропускаем управление до следующего действия; NULL — действий больше нет
+static const struct Cmd *next_action(struct Sim *s) {
+    while (s->status == DINO_RUNNING) {
+        if (s->pc >= s->prog->n) {
+            s->status = DINO_FINISHED;
+            break;
+        }
+        const struct Cmd *c = &s->prog->cmds[s->pc++];
+        if (!is_control(c->op)) return c;
+        exec_control(s, c);
+    }
+    return NULL;
+}
+
+static void plan_cell(struct AgentPlan *pl, int x, int y, int plane, char val) {
+    pl->cx[pl->ncells] = x;
+    pl->cy[pl->ncells] = y;
+    pl->plane[pl->ncells] = (char)plane;
+    pl->val[pl->ncells++] = val;
+}
+
+/// план агента по полю на начало тика; поле не трогаем, правила те же, что у одного дино.
+/// SIZE, SAVE, LOAD, FILL, PAINT RECT и CLEAR у агентов ничего не делают — поле общее,
+/// а клеток они меняют больше, чем можно застолбить; GOTO тоже (кеш путей у поля
+/// один на всех, а планируют агенты параллельно)
+static void plan_agent(const struct Field *shared, struct Sim *a, struct AgentPlan *pl) {
+    memset(pl, 0, sizeof(*pl));
+    const struct Cmd *c = next_action(a);
+    if (!c) return;
+    pl->act = 1;
+    a->steps++;
+
+    struct Field v = *shared; // свой взгляд на общее поле: только координаты дино другие
+    v.dino_x = a->field.dino_x;
+    v.dino_y = a->field.dino_y;
+    v.has_dino = a->field.has_dino;
+    v.msg = NULL;
+    v.log = NULL;
+    v.prof = NULL; // счётчики общие, а планируют параллельно
+    if (!v.has_dino) return;
+
+    int tx = v.dino_x, ty = v.dino_y;
+    if (c->op != OP_MOVE && c->op != OP_JUMP && c->op != OP_START && c->op != OP_PAINT)
+        step_dir(&v, c->dir, &tx, &ty);
+    char cell = v.tiles[ty][tx];
+
+    switch (c->op) {
+    case OP_START:
+        if (c->a < 0 || c->a >= v.w || c->b < 0 || c->b >= v.h) break;
+        pl->moves = 1;
+        pl->tx = c->a;
+        pl->ty = c->b;
+        break;
+    case OP_MOVE:
+    case OP_JUMP: {
+        int r = c->op == OP_MOVE ? move_dino(&v, c->dir) : jump_dino(&v, c->dir, c->a);
+        if (r == DINO_FELL) pl->fell = 1; // падение решается по полю на начало тика
+        else if (v.dino_x != a->field.dino_x || v.dino_y != a->field.dino_y) {
+            pl->moves = 1;
+            pl->tx = v.dino_x;
+            pl->ty = v.dino_y;
+        }
+        break;
+    }
+    case OP_PAINT: plan_cell(pl, v.dino_x, v.dino_y, 1, c->c); break;
+    case OP_DIG:   plan_cell(pl, tx, ty, 0, '%'); break;
+    case OP_MOUND: plan_cell(pl, tx, ty, 0, cell == '%' ? '_' : '^'); break;
+    case OP_GROW:  if (cell == '_') plan_cell(pl, tx, ty, 0, '&'); break;
+    case OP_CUT:   if (cell == '&') plan_cell(pl, tx, ty, 0, '_'); break;
+    case OP_MAKE:  if (cell == '_') plan_cell(pl, tx, ty, 0, '@'); break;
+    case OP_PUSH: {
+        if (cell != '@') break;
+        int nx = tx, ny = ty;
+        step_dir(&v, c->dir, &nx, &ny);
+        char to = v.tiles[ny][nx];
+        if (to == '^' || to == '&' || to == '@') break;
+        plan_cell(pl, nx, ny, 0, to == '%' ? '_' : '@');
+        plan_cell(pl, tx, ty, 0, '_');
+        break;
+    }
+    }
+}
+
+static void plan_range(struct Crowd *c, int from, int to) {
+    for (int i = from; i < to; i++) plan_agent(&c->field, &c->agents[i], &c->plans[i]);
+}
+
+/// клетка свободна для агента i и застолблена им
+static int cell_ok(const struct Crowd *c, int i, int x, int y) {
+    size_t k = (size_t)y * c->field.w + x;
+    return (c->occ[k] == 0 || c->occ[k] == i + 1) && c->claim[k] == i;
+}
+
+static void claim_cell(struct Crowd *c, int i, int x, int y) {
+    size_t k = (size_t)y * c->field.w + x;
+    if (c->claim[k] < 0) c->claim[k] = i;
+}
+
+static void unclaim_cell(struct Crowd *c, int x, int y) {
+    c->claim[(size_t)y * c->field.w + x] = -1;
+}
+
+/// применяем планы по порядку номеров; сколько агентов что-то сделали
+static int resolve_tick(struct Crowd *c) {
+    struct Field *f = &c->field;
+    int acted = 0;
+
+    for (int i = 0; i < c->n; i++) {
+        const struct AgentPlan *pl = &c->plans[i];
+        if (pl->moves) claim_cell(c, i, pl->tx, pl->ty);
+        for (int k = 0; k < pl->ncells; k++) claim_cell(c, i, pl->cx[k], pl->cy[k]);
+    }
+
+    for (int i = 0; i < c->n; i++) {
+        const struct AgentPlan *pl = &c->plans[i];
+        struct Field *d = &c->agents[i].field;
+        if (!pl->act) continue;
+        acted++;
+
+        if (pl->fell) {
+            c->occ[(size_t)d->dino_y * f->w + d->dino_x] = 0;
+            d->has_dino = 0;
+            c->agents[i].status = DINO_FELL;
+            continue;
+        }
+        int ok = !pl->moves || cell_ok(c, i, pl->tx, pl->ty);
+        for (int k = 0; ok && k < pl->ncells; k++) ok = cell_ok(c, i, pl->cx[k], pl->cy[k]);
+        if (!ok) continue; // проиграл клетку — действие пропало, как упёрся в гору
+
+        for (int k = 0; k < pl->ncells; k++) {
+            if (pl->plane[k]) set_color(f, pl->cx[k], pl->cy[k], pl->val[k]);
+            else set_tile(f, pl->cx[k], pl->cy[k], pl->val[k]);
+        }
+        if (pl->moves) {
+            c->occ[(size_t)d->dino_y * f->w + d->dino_x] = 0;
+            c->occ[(size_t)pl->ty * f->w + pl->tx] = i + 1;
+            d->dino_x = pl->tx;
+            d->dino_y = pl->ty;
+        }
+    }
+
+    for (int i = 0; i < c->n; i++) {
+        const struct AgentPlan *pl = &c->plans[i];
+        if (pl->moves) unclaim_cell(c, pl->tx, pl->ty);
+        for (int k = 0; k < pl->ncells; k++) unclaim_cell(c, pl->cx[k], pl->cy[k]);
+    }
+    if (acted) c->ticks++;
+    return acted;
+}
+
+/// один тик в этом потоке; сколько агентов что-то сделали (0 — все закончили)
+int tick_crowd(struct Crowd *c) {
+    if (!c->n) return 0;
+    plan_range(c, 0, c->n);
+    return resolve_tick(c);
+}
+
+/// потоки живут весь прогон: планируют свой кусок агентов между двумя барьерами,
+/// а применяет планы главный поток
+struct CrowdWorker {
+    struct Crowd *c;
+    int id;
+    pthread_barrier_t *bar;
+    const int *stop;
+    struct CrowdGate *gate;
+};
+
+/// до старта потоки ждут здесь: барьер заводится, только когда ясно, сколько их запустилось
+struct CrowdGate {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int open;
+};
+
+static void crowd_chunk(const struct Crowd *c, int id, int *from, int *to) {
+    *from = (int)((long long)c->n * id / c->threads);
+    *to = (int)((long long)c->n * (id + 1) / c->threads);
+}
+
+static void *crowd_thread(void *arg) {
+    struct CrowdWorker *w = arg;
+    pthread_mutex_lock(&w->gate->lock);
+    while (!w->gate->open) pthread_cond_wait(&w->gate->cond, &w->gate->lock);
+    pthread_mutex_unlock(&w->gate->lock);
+    if (*w->stop) return NULL;
+
+    int from, to;
+    crowd_chunk(w->c, w->id, &from, &to);
+    for (;;) {
+        pthread_barrier_wait(w->bar);
+        if (*w->stop) break;
+        plan_range(w->c, from, to);
+        pthread_barrier_wait(w->bar);
+    }
+    return NULL;
+}
+
+/// гоняем, пока кто-то действует, но не больше max_ticks тиков (< 0 — без ограничения);
+/// сколько тиков сделано
+long run_crowd(struct Crowd *c, long max_ticks) {
+    long start = c->ticks;
+    int threads = c->threads < c->n ? c->threads : c->n;
+
+    if (threads <= 1) {
+        while (max_ticks != 0 && tick_crowd(c))
+            if (max_ticks > 0) max_ticks--;
+        return c->ticks - start;
+    }
+
+    int saved = c->threads, stop = 0;
+    pthread_barrier_t bar;
+    struct CrowdGate gate = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+    struct CrowdWorker *workers = calloc(threads, sizeof(*workers));
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    int started = 1;
+    if (workers && tids) {
+        for (; started < threads; started++) {
+            workers[started] = (struct CrowdWorker){ c, started, &bar, &stop, &gate };
+            if (pthread_create(&tids[started], NULL, crowd_thread, &workers[started]) != 0) break;
+        }
+    }
+    // куски агентов делим на тех, кто реально запустился
+    c->threads = started;
+    if (started > 1) pthread_barrier_init(&bar, NULL, started);
+    else stop = 1;
+    pthread_mutex_lock(&gate.lock);
+    gate.open = 1;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+
+    if (started == 1) {
+        pthread_mutex_destroy(&gate.lock);
+        pthread_cond_destroy(&gate.cond);
+        free(workers); free(tids);
+        c->threads = saved;
+        while (max_ticks != 0 && tick_crowd(c))
+            if (max_ticks > 0) max_ticks--;
+        return c->ticks - start;
+    }
+
+    int from, to;
+    crowd_chunk(c, 0, &from, &to);
+    while (max_ticks != 0) {
+        pthread_barrier_wait(&bar);
+        plan_range(c, from, to);
+        pthread_barrier_wait(&bar);
+        if (!resolve_tick(c)) break;
+        if (max_ticks > 0) max_ticks--;
+    }
+    stop = 1;
+    pthread_barrier_wait(&bar);
+    for (int t = 1; t < started; t++) pthread_join(tids[t], NULL);
+
+    pthread_barrier_destroy(&bar);
+    pthread_mutex_destroy(&gate.lock);
+    pthread_cond_destroy(&gate.cond);
+    free(workers); free(tids);
+    c->threads = saved;
+    return c->ticks - start;
+}
+
+void fprint_crowd(FILE *out, const struct Crowd *c) {
+    const struct Field *f = &c->field;
+    if (!f->tiles) return;
+
+    for (int y = 0; y < f->h; y++) {
+        for (int x = 0; x < f->w; x++) {
+            if (c->occ && c->occ[(size_t)y * f->w + x])
+                putc('#', out);
+            else if (f->colors[y][x] != ' ')
+                putc(f->colors[y][x], out);
+            else
+                putc(f->tiles[y][x], out);
+        }
+        putc('\n', out);
+    }
+}
+
+
+///ПАЧКА ПРОГРАММ НА ВСЕХ ЯДРАХ
+/// у каждого потока своя очередь [lo, hi) номеров программ: хозяин берёт спереди,
+/// а освободившийся поток ворует у соседа заднюю половину
+struct BatchQueue {
+    pthread_mutex_t lock;
+    int lo, hi;
+};
+
+struct BatchWorker {
+    int id, count;
+    struct BatchQueue *queues;
+    char **paths;
+    struct BatchResult *res;
+};
+
+static int batch_take(struct BatchQueue *q) {
+    int i = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->lo < q->hi) i = q->lo++;
+    pthread_mutex_unlock(&q->lock);
+    return i;
+}
+
+static int batch_steal(struct BatchWorker *w) {
+    struct BatchQueue *mine = &w->queues[w->id];
+
+    for (int k = 1; k < w->count; k++) {
+        struct BatchQueue *v = &w->queues[(w->id + k) % w->count];
+        int lo = 0, hi = 0;
+
+        pthread_mutex_lock(&v->lock);
+        if (v->lo < v->hi) {
+            hi = v->hi;
+            lo = v->lo + (v->hi - v->lo) / 2; // забираем заднюю половину
+            v->hi = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (lo == hi) continue;
+
+        pthread_mutex_lock(&mine->lock);
+        mine->lo = lo + 1;
+        mine->hi = hi;
+        pthread_mutex_unlock(&mine->lock);
+        return lo;
+    }
+    return -1;
+}
+
+static void batch_one(const char *path, struct BatchResult *r) {
+    struct Program prog = {0};
+    struct Sim sim; // поле у каждого потока своё
+
+    memset(r, 0, sizeof(*r));
+    if (!load_program(&prog, path)) {
+        r->status = prog.err_line ? BATCH_SYNTAX : BATCH_UNREADABLE;
+        r->err_no = errno;
+        r->err_line = prog.err_line;
+        r->err_col = prog.err_col;
+        memcpy(r->err, prog.err, sizeof(r->err));
+        free_program(&prog);
+        return;
+    }
+    init_sim(&sim, &prog);
+    r->status = run_sim(&sim, -1);
+    r->has_dino = sim.field.has_dino;
+    r->x = sim.field.dino_x;
+    r->y = sim.field.dino_y;
+    r->steps = sim.steps;
+    r->hash = hash_field(&sim.field);
+    free_sim(&sim);
+    free_program(&prog);
+}
+
+static void *batch_thread(void *arg) {
+    struct BatchWorker *w = arg;
+    for (;;) {
+        int i = batch_take(&w->queues[w->id]);
+        if (i < 0) i = batch_steal(w);
+        if (i < 0) break; // воровать больше не у кого
+        batch_one(w->paths[i], &w->res[i]);
+    }
+    return NULL;
+}
+
+/// прогнать n программ на threads потоках, итоги в res[i] в том же порядке что paths
+int run_batch(char **paths, int n, int threads, struct BatchResult *res) {
+    if (threads < 1) threads = 1;
+    if (threads > n) threads = n > 0 ? n : 1;
+
+    struct BatchQueue *queues = calloc(threads, sizeof(*queues));
+    struct BatchWorker *workers = calloc(threads, sizeof(*workers));
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    if (!queues || !workers || !tids) {
+        free(queues); free(workers); free(tids);
+        return 0;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        pthread_mutex_init(&queues[t].lock, NULL);
+        queues[t].lo = (int)((long long)n * t / threads);
+        queues[t].hi = (int)((long long)n * (t + 1) / threads);
+        workers[t] = (struct BatchWorker){ t, threads, queues, paths, res };
+    }
+    // поток не запустился — его очередь разворуют остальные (или доделает главный)
+    int started = 1;
+    while (started < threads && pthread_create(&tids[started], NULL, batch_thread, &workers[started]) == 0)
+        started++;
+    batch_thread(&workers[0]);
+    for (int t = 1; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    for (int t = 0; t < threads; t++) pthread_mutex_destroy(&queues[t].lock);
+    free(queues); free(workers); free(tids);
+    return 1;
+}
+
+
+#ifndef MOVDINO_NO_MAIN
+static int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+static int add_path(char ***paths, int *n, int *cap, const char *p) {
+    if (*n == *cap) {
+        int c = *cap ? *cap * 2 : 64;
+        char **np = realloc(*paths, c * sizeof(char *));
+        if (!np) return 0;
+        *paths = np;
+        *cap = c;
+    }
+    (*paths)[(*n)++] = strdup(p);
+    return 1;
+}
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/// папка раскрывается в её файлы (по алфавиту), остальное — как есть
+static int collect_paths(char **args, int argn, char ***paths, int *n) {
+    int cap = 0;
+    struct stat st;
+
+    for (int i = 0; i < argn; i++) {
+        if (stat(args[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            if (!add_path(paths, n, &cap, args[i])) return 0;
+            continue;
+        }
+
+        DIR *d = opendir(args[i]);
+        if (!d) { perror(args[i]); continue; }
+        int first = *n;
+        struct dirent *e;
+        while ((e = readdir(d))) {
+            char full[4096];
+            snprintf(full, sizeof(full), "%s/%s", args[i], e->d_name);
+            if (stat(full, &st) == 0 && S_ISREG(st.st_mode))
+                if (!add_path(paths, n, &cap, full)) { closedir(d); return 0; }
+        }
+        closedir(d);
+        qsort(*paths + first, *n - first, sizeof(char *), cmp_path);
+    }
+    return 1;
+}
+
+static const char *status_name(int status) {
+    switch (status) {
+    case DINO_RUNNING:  return "running";
+    case DINO_FELL:     return "fell";
+    case DINO_FINISHED: return "finished";
+    case DINO_ERROR:    return "error";
+    case BATCH_UNREADABLE: return "unreadable";
+    case BATCH_SYNTAX:     return "syntax";
+    }
+    return "?";
+}
+
+/// --batch [-j N] <папка|файл>...  — по строке на программу:
+/// путь, исход, x y (или - -), шагов, хеш поля. почему программа не загрузилась —
+/// потом в stderr, и тогда выходим с 1
+static int batch_main(int argn, char *args[]) {
+    int threads = cpu_count();
+    int i = 0;
+
+    if (i + 1 < argn && strcmp(args[i], "-j") == 0) {
+        threads = atoi(args[i + 1]);
+        i += 2;
+    }
+
+    char **paths = NULL;
+    int n = 0;
+    if (!collect_paths(args + i, argn - i, &paths, &n)) {
+        fprintf(stderr, "не хватило памяти\n");
+        return 1;
+    }
+
+    struct BatchResult *res = calloc(n ? n : 1, sizeof(*res));
+    if (!res || !run_batch(paths, n, threads, res)) {
+        fprintf(stderr, "не хватило памяти\n");
+        return 1;
+    }
+
+    for (int k = 0; k < n; k++) {
+        struct BatchResult *r = &res[k];
+        if (r->has_dino)
+            printf("%s %s %d %d %ld %016llx\n", paths[k], status_name(r->status),
+                   r->x, r->y, r->steps, (unsigned long long)r->hash);
+        else
+            printf("%s %s - - %ld %016llx\n", paths[k], status_name(r->status),
+                   r->steps, (unsigned long long)r->hash);
+    }
+
+    int failed = 0;
+    for (int k = 0; k < n; k++) {
+        struct BatchResult *r = &res[k];
+        if (r->status == BATCH_UNREADABLE || r->status == BATCH_SYNTAX) {
+            struct Program p = { .err_line = r->err_line, .err_col = r->err_col };
+            memcpy(p.err, r->err, sizeof(p.err));
+            errno = r->err_no;
+            fprint_program_error(stderr, paths[k], &p);
+            failed = 1;
+        }
+        free(paths[k]);
+    }
+    free(paths);
+    free(res);
+    return failed;
+}
+
+/// --crowd [-j N] [-t тиков] <образ поля> <агенты> — в файле агентов строки "x y программа";
+/// одинаковые программы читаются один раз. печатаем итоговое поле и сводку
+static int crowd_main(int argn, char *args[]) {
+    int threads = cpu_count();
+    long max_ticks = -1;
+    int i = 0;
+
+    for (; i + 1 < argn && args[i][0] == '-'; i += 2) {
+        if (strcmp(args[i], "-j") == 0) threads = atoi(args[i + 1]);
+        else if (strcmp(args[i], "-t") == 0) max_ticks = atol(args[i + 1]);
+        else break;
+    }
+    if (argn - i != 2) {
+        fprintf(stderr, "использование: movdino --crowd [-j N] [-t тиков] <образ поля> <агенты>\n");
+        return 1;
+    }
+
+    struct Crowd crowd;
+    init_crowd(&crowd, threads);
+    if (!load_field(&crowd.field, args[i])) {
+        perror(args[i]);
+        return 1;
+    }
+    FILE *list = fopen(args[i + 1], "r");
+    if (!list) {
+        perror(args[i + 1]);
+        free_crowd(&crowd);
+        return 1;
+    }
+
+    char **paths = NULL;
+    struct Program **progs = NULL;
+    int nprogs = 0, cap = 0, ok = 1;
+    long line_no = 0;
+    char line[4096], path[4096];
+    while (ok && fgets(line, sizeof(line), list)) {
+        int x, y, k;
+        line_no++;
+        if (sscanf(line, "%d %d %4095[^\r\n]", &x, &y, path) != 3) continue;
+
+        for (k = 0; k < nprogs && strcmp(paths[k], path) != 0; k++) {}
+        if (k == nprogs) {
+            if (!add_path(&paths, &nprogs, &cap, path)) { ok = 0; break; }
+            struct Program **np = realloc(progs, cap * sizeof(*progs));
+            if (np) progs = np;
+            if (!np || !(progs[k] = calloc(1, sizeof(struct Program)))) {
+                free(paths[--nprogs]);
+                ok = 0;
+                break;
+            }
+            if (!load_program(progs[k], path)) {
+                fprint_program_error(stderr, path, progs[k]);
+                ok = 0;
+                break;
+            }
+        }
+        if (!add_agent(&crowd, progs[k], x, y)) {
+            fprintf(stderr, "%s:%ld: нельзя поставить дино в %d %d\n", args[i + 1], line_no, x, y);
+            ok = 0;
+        }
+    }
+    fclose(list);
+
+    if (ok) {
+        run_crowd(&crowd, max_ticks);
+        fprint_crowd(stdout, &crowd);
+        int fell = 0;
+        for (int a = 0; a < crowd.n; a++) fell += crowd.agents[a].status == DINO_FELL;
+        printf("\nагентов %d, упало %d, тиков %ld, хеш поля %016llx\n",
+               crowd.n, fell, crowd.ticks, (unsigned long long)hash_field(&crowd.field));
+    }
+
+    free_crowd(&crowd);
+    for (int k = 0; k < nprogs; k++) {
+        free_program(progs[k]);
+        free(progs[k]);
+        free(paths[k]);
+    }
+    free(progs);
+    free(paths);
+    return !ok;
+}
+
+/// разбор -s -n -w -h -m (и для --bench ещё -r -o -l --sweep); 0 — непонятный ключ
+struct BenchArgs {
+    struct GenOpts gen;
+    long render_steps;
+    const char *out, *label;
+    int sweep;
+};
+
+static int gen_args(int argn, char *args[], struct BenchArgs *b) {
+    b->gen = (struct GenOpts){ 1, 100, 100, 1000000, MIX_MIXED };
+    b->render_steps = 20000;
+    b->out = NULL;
+    b->label = "-";
+    b->sweep = 0;
+
+    for (int i = 0; i < argn; i++) {
+        if (strcmp(args[i], "--sweep") == 0) { b->sweep = 1; continue; }
+        if (i + 1 >= argn) return 0;
+        const char *v = args[++i];
+        switch (args[i - 1][0] == '-' ? args[i - 1][1] : 0) {
+        case 's': b->gen.seed = strtoull(v, NULL, 10); break;
+        case 'n': b->gen.len = atol(v); break;
+        case 'w': b->gen.w = atoi(v); break;
+        case 'h': b->gen.h = atoi(v); break;
+        case 'm': if ((b->gen.mix = gen_mix(v)) < 0) return 0; break;
+        case 'r': b->render_steps = atol(v); break;
+        case 'o': b->out = v; break;
+        case 'l': b->label = v; break;
+        default: return 0;
+        }
+    }
+    return 1;
+}
+
+/// --gen: программа в stdout
+static int gen_main(int argn, char *args[]) {
+    struct BenchArgs b;
+    if (!gen_args(argn, args, &b)) {
+        fprintf(stderr, "использование: movdino --gen [-s seed] [-n команд] [-w W] [-h H] [-m mixed|jump|push|paint]\n");
+        return 1;
+    }
+    struct Gen g;
+    char line[64];
+    init_gen(&g, &b.gen);
+    while (gen_line(&g, line, sizeof(line))) printf("%s\n", line);
+    return 0;
+}
+
+/// пик памяти процесса за всю жизнь; поэтому bench_isolated гоняет каждый замер в своём процессе
+static long peak_kb(void) {
+#ifdef _WIN32
+    return 0; // без psapi не узнать
+#else
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+#endif
+}
+
+/// один замер: разбор готового текста, прогон без вывода и первые render_steps шагов с выводом
+static int bench_one(const struct BenchArgs *b, const struct GenOpts *o, FILE *tsv) {
+    struct Gen g;
+    char line[64];
+    size_t len = 0, cap = 1 << 20;
+    char *text = malloc(cap);
+    if (!text) return 0;
+
+    init_gen(&g, o);
+    while (gen_line(&g, line, sizeof(line))) {
+        size_t k = strlen(line);
+        if (len + k + 2 > cap) {
+            char *t = realloc(text, cap *= 2);
+            if (!t) { free(text); return 0; }
+            text = t;
+        }
+        memcpy(text + len, line, k);
+        text[len + k] = '\n';
+        len += k + 1;
+    }
+    text[len] = '\0';
+
+    struct Program prog = {0};
+    uint64_t t0 = now_ns();
+    int ok = compile_program(&prog, text);
+    double parse_s = (now_ns() - t0) / 1e9;
+    free(text);
+    if (!ok) { free_program(&prog); return 0; }
+
+    struct Sim sim;
+    init_sim(&sim, &prog);
+    t0 = now_ns();
+    run_sim(&sim, -1);
+    double run_s = (now_ns() - t0) / 1e9;
+    long steps = sim.steps;
+    free_sim(&sim);
+
+#ifdef _WIN32
+    FILE *sink = fopen("NUL", "w");
+#else
+    FILE *sink = fopen("/dev/null", "w");
+#endif
+    long rendered = 0;
+    double render_s = 0;
+    if (sink) {
+        init_sim(&sim, &prog);
+        sim.field.msg = sink;
+        t0 = now_ns();
+        while (rendered < b->render_steps && sim.status == DINO_RUNNING) { // как print_frames
+            long before = sim.steps;
+            if (step_sim(&sim) == DINO_FELL || sim.steps == before) break;
+            fprint_field(sink, &sim.field);
+            putc('\n', sink);
+            rendered++;
+        }
+        fflush(sink);
+        render_s = (now_ns() - t0) / 1e9;
+        free_sim(&sim);
+        fclose(sink);
+    }
+    free_program(&prog);
+
+    double parse_rate = parse_s > 0 ? (o->len + 2) / parse_s : 0;
+    double run_rate = run_s > 0 ? steps / run_s : 0;
+    double render_rate = render_s > 0 ? rendered / render_s : 0;
+    long kb = peak_kb();
+
+    printf("%-6s %-5s %3dx%-3d %9ld команд  разбор %11.0f строк/с  без вывода %11.0f ком/с  с выводом %9.0f ком/с  пик %ld КБ\n",
+           gen_mix_name(o->mix), b->label, o->w, o->h, o->len, parse_rate, run_rate, render_rate, kb);
+    if (tsv)
+        fprintf(tsv, "%s\t%llu\t%s\t%d\t%d\t%ld\t%.0f\t%.0f\t%.0f\t%ld\n", b->label, (unsigned long long)o->seed,
+                gen_mix_name(o->mix), o->w, o->h, o->len, parse_rate, run_rate, render_rate, kb);
+    return 1;
+}
+
+/// замер в отдельном процессе, чтобы пик памяти в строке был его собственный,
+/// а не самого большого из прошлых замеров. без fork (Windows) — прямо здесь
+static int bench_isolated(const struct BenchArgs *b, const struct GenOpts *o, FILE *tsv) {
+#ifdef _WIN32
+    return bench_one(b, o, tsv);
+#else
+    fflush(stdout);
+    if (tsv) fflush(tsv);
+    pid_t pid = fork();
+    if (pid < 0) return bench_one(b, o, tsv);
+    if (pid == 0) {
+        int ok = bench_one(b, o, tsv);
+        fflush(stdout);
+        if (tsv) fflush(tsv);
+        _exit(ok ? 0 : 1);
+    }
+    int st;
+    if (waitpid(pid, &st, 0) != pid) return 0;
+    return WIFEXITED(st) && WEXITSTATUS(st) == 0;
+#endif
+}
+
+/// --bench: один замер или --sweep по всем смесям и размерам 10, 50, 100.
+/// с -o строки дописываются в TSV (заголовок — если файл пустой), чтобы сравнивать ревизии по -l
+static int bench_main(int argn, char *args[]) {
+    struct BenchArgs b;
+    if (!gen_args(argn, args, &b)) {
+        fprintf(stderr, "использование: movdino --bench [-s seed] [-n команд] [-w W] [-h H] [-m смесь]\n"
+                        "                       [-r шагов с выводом] [-l метка] [-o файл.tsv] [--sweep]\n");
+        return 1;
+    }
+
+    FILE *tsv = NULL;
+    if (b.out) {
+        tsv = fopen(b.out, "a");
+        if (!tsv) { perror(b.out); return 1; }
+        if (ftell(tsv) == 0)
+            fprintf(tsv, "label\tseed\tmix\tw\th\tlen\tparse_lines_s\trun_cmds_s\trender_cmds_s\tpeak_kb\n");
+    }
+
+    int ok = 1;
+    if (!b.sweep) {
+        ok = bench_isolated(&b, &b.gen, tsv);
+    } else {
+        static const int sizes[] = { 10, 50, 100 };
+        for (int m = 0; ok && m < MIX_COUNT; m++) {
+            for (int k = 0; ok && k < 3; k++) {
+                struct GenOpts o = b.gen;
+                o.mix = m;
+                o.w = o.h = sizes[k];
+                ok = bench_isolated(&b, &o, tsv);
+            }
+        }
+    }
+    if (tsv) fclose(tsv);
+    if (!ok) fprintf(stderr, "не хватило памяти\n");
+    return !ok;
+}
+
+/// --replay трасса: печатает записанные кадры и сообщения так же, как обычный прогон
+static int replay_main(int argn, char *args[]) {
+    if (argn != 1) {
+        fprintf(stderr, "использование: movdino --replay <трасса>\n");
+        return 1;
+    }
+    struct Trace t;
+    if (!open_trace(&t, args[0], 0)) {
+        perror(args[0]);
+        return 1;
+    }
+    int r = replay_frames(&t, stdout);
+    close_trace(&t);
+    if (r < 0) {
+        fprintf(stderr, "%s: трасса испорчена после кадра %llu\n", args[0], (unsigned long long)t.frames);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argn, char *args[]) {
+    if (argn >= 2 && strcmp(args[1], "--replay") == 0)
+        return replay_main(argn - 2, args + 2);
+    if (argn >= 2 && strcmp(args[1], "--gen") == 0)
+        return gen_main(argn - 2, args + 2);
+    if (argn >= 2 && strcmp(args[1], "--bench") == 0)
+        return bench_main(argn - 2, args + 2);
+    if (argn >= 2 && strcmp(args[1], "--batch") == 0)
+        return batch_main(argn - 2, args + 2);
+    if (argn >= 2 && strcmp(args[1], "--crowd") == 0)
+        return crowd_main(argn - 2, args + 2);
+
+    // --cycles: без промежуточных кадров, повторы с одинаковым состоянием проматываются
+    // --seek N: прогон с историей, потом кадр после шага N собирается из неё
+    // --load/--save образ: начальное поле из образа, итоговое — в образ
+    // --profile, --profile-json: счётчики и время по командам в stderr в конце
+    // --record трасса: кадры не печатаются, а пишутся сжатыми (смотреть через --replay)
+    int cycles = 0, profile = 0;
+    long seek = -1;
+    const char *load = NULL, *save = NULL, *record = NULL;
+    while (argn >= 2 && strncmp(args[1], "--", 2) == 0) {
+        int one = 1;
+        if (strcmp(args[1], "--cycles") == 0) cycles = 1;
+        else if (strcmp(args[1], "--profile") == 0) profile = 1;
+        else if (strcmp(args[1], "--profile-json") == 0) profile = 2;
+        else one = 0;
+        if (one) {
+            argn--;
+            args++;
+            continue;
+        }
+        if (argn < 3) break;
+        if (strcmp(args[1], "--seek") == 0) seek = atol(args[2]);
+        else if (strcmp(args[1], "--load") == 0) load = args[2];
+        else if (strcmp(args[1], "--save") == 0) save = args[2];
+        else if (strcmp(args[1], "--record") == 0) record = args[2];
+        else break;
+        argn -= 2;
+        args += 2;
+    }
+
+    if (argn < 2) {
+        fprintf(stderr, "использование: movdino [--cycles | --seek N] [--load образ] [--save образ]\n"
+                        "                       [--record трасса] [--profile | --profile-json] <файл программы>\n"
+                        "               movdino --replay <трасса>\n"
+                        "               movdino --batch [-j N] <папка|файлы...>\n"
+                        "               movdino --crowd [-j N] [-t тиков] <образ поля> <агенты>\n"
+                        "               movdino --gen [-s seed] [-n команд] [-m смесь] > программа\n"
+                        "               movdino --bench [--sweep] [-l метка] [-o файл.tsv]\n");
+        return 1;
+    }
+
+    struct Profile prof = {0};
+    uint64_t t0 = now_ns();
+    struct Program prog = {0};
+    int loaded = load_program(&prog, args[1]);
+    prof.parse_ns = now_ns() - t0;
+    prof.parse_lines = prog.lines;
+    if (!loaded || (cycles && !find_loops(&prog))) {
+        fprint_program_error(stderr, args[1], &prog);
+        free_program(&prog);
+        return 1;
+    }
+
+    struct Sim sim;
+    init_sim(&sim, &prog);
+    if (load && !load_field(&sim.field, load)) {
+        perror(load);
+        free_sim(&sim);
+        free_program(&prog);
+        return 1;
+    }
+    if (profile) sim.field.prof = &prof;
+
+    int bad_seek = 0, failed = 0;
+    if (seek >= 0) {
+        struct History hist;
+        struct Field view = {0};
+        init_history(&hist, 0);
+        sim.hist = &hist;
+        run_sim(&sim, -1);
+        if (seek_field(&hist, seek, &view)) {
+            print_field(&view);
+            printf("\n");
+        } else {
+            bad_seek = 1;
+            if (hist.failed) fprintf(stderr, "%s: не хватило памяти на историю\n", args[1]);
+            else fprintf(stderr, "%s: шага %ld нет (всего %ld)\n", args[1], seek, sim.steps);
+        }
+        if (view.tiles) free_field(&view);
+        detach_history(&sim);
+        free_history(&hist);
+    } else if (cycles) {
+        sim.cycles = 1;
+        zobrist_on(&sim.field);
+        if (run_sim(&sim, -1) == DINO_FINISHED) {
+            print_field(&sim.field);
+            printf("\n");
+        }
+    } else if (record) {
+        struct Trace t;
+        if (!open_trace(&t, record, 1)) {
+            perror(record);
+            failed = 1;
+        } else {
+            int ok = record_frames(&sim, &t);
+            if (!close_trace(&t) || !ok) {
+                perror(record);
+                failed = 1;
+            } else {
+                struct stat st;
+                long long size = stat(record, &st) == 0 ? (long long)st.st_size : -1;
+                fprintf(stderr, "%s: кадров %llu, %llu байт -> %lld байт (%.1f:1)\n", record,
+                        (unsigned long long)t.frames, (unsigned long long)t.raw_bytes, size,
+                        size > 0 ? (double)t.raw_bytes / size : 0.0);
+            }
+        }
+    } else {
+        print_frames(&sim, stdout);
+    }
+
+    int status = sim.status;
+    failed |= bad_seek;
+    if (profile) {
+        prof.skipped = sim.skipped;
+        fprint_profile(stderr, &prof, profile == 2);
+    }
+    if (save && !save_field(&sim.field, save)) {
+        perror(save);
+        failed = 1;
+    }
+    free_sim(&sim);
+    free_program(&prog);
+    if (status == DINO_ERROR) {
+        fprintf(stderr, "%s: слишком глубокие CALL/REPEAT\n", args[1]);
+        return 1;
+    }
+    return failed;
+}
+#endif
@@ -0,0 +1,336 @@
+#ifndef MOVDINO_H
+#define MOVDINO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+///ДВИЖОК ДИНО КАК БИБЛИОТЕКА
+///  gcc -DMOVDINO_NO_MAIN -c movdino.c      (без main, для встраивания)
+///  поле + программа + шаги, никаких exit() и печати без спроса
+
+struct History;
+struct PathCache;
+struct Profile;
+
+struct Field {
+    int w, h;
+    char **tiles;
+    int dino_x, dino_y;
+    int has_dino;
+    char **colors;
+    // индекс препятствий ('^', '&', '@'): битсеты по строкам и по столбцам
+    int row_words, col_words;
+    uint64_t *row_block; // h строк по row_words слов, бит x
+    uint64_t *col_block; // w столбцов по col_words слов, бит y
+    FILE *msg;           // куда писать сообщения дино, NULL — молчать
+    // хеш Зобриста клеток и красок (пустое поле = 0), ведётся только если zon
+    int zon;
+    uint64_t zhash;
+    struct History *log; // куда записывать изменённые клетки, NULL — никуда
+    // поле из образа (load_field): строки, краски и индекс указывают внутрь него
+    void *image;
+    size_t image_len;
+    // для GOTO: поля расстояний до недавних целей и счётчик изменений проходимости
+    struct PathCache *paths;
+    uint64_t pass_ver;
+    struct Profile *prof; // счётчики профилировщика, NULL — выключен
+};
+
+/// что случилось с дино
+enum DinoStatus {
+    DINO_RUNNING,  // программа ещё идёт
+    DINO_FELL,     // упал в яму
+    DINO_FINISHED, // команды кончились
+    DINO_ERROR     // слишком глубокие CALL/REPEAT (бесконечная рекурсия)
+};
+
+enum DinoOp {
+    OP_NOP,   // пустая строка (кадр всё равно печатается); незнакомое слово — ошибка компиляции
+    OP_SIZE, OP_START, OP_MOVE, OP_PAINT, OP_DIG, OP_MOUND,
+    OP_JUMP, OP_GROW, OP_CUT, OP_MAKE, OP_PUSH,
+    OP_GOTO,          // a, b — куда идти
+    OP_FILL, OP_PAINT_RECT, OP_CLEAR, // область a, b, w, h; c — клетка или цвет
+    OP_SAVE, OP_LOAD, // a — номер пути в Program.paths
+    // управление: кадров не дают, выполняются между действиями
+    OP_REPEAT, // a — сколько раз, b — где его END
+    OP_END,    // конец REPEAT: b — где его REPEAT
+    OP_DEF,    // перепрыгнуть тело процедуры: a — куда
+    OP_RET,    // конец DEF
+    OP_CALL,   // a — начало тела процедуры
+    OP_COUNT
+};
+
+enum DinoDir { DIR_NONE, DIR_UP, DIR_DOWN, DIR_LEFT, DIR_RIGHT };
+
+/// одна скомпилированная команда
+struct Cmd {
+    unsigned char op;  // DinoOp
+    unsigned char dir; // DinoDir
+    char c;            // цвет для PAINT, клетка для FILL
+    int a, b;          // числа: SIZE w h, START x y, JUMP dir a, переходы
+    int w, h;          // размер области для FILL, PAINT RECT, CLEAR
+};
+
+/// процедура DEF name ... END
+struct Proc {
+    char name[32];
+    long at;   // первая команда тела, -1 пока DEF не встретился
+    long line, col; // где имя встретилось впервые (для ошибки "нет DEF")
+};
+
+#define DINO_MAX_DEPTH 65536 // глубина CALL и вложенных REPEAT при выполнении
+#define MAX_PROGRAM INT_MAX  // команд в программе: переходы в Cmd.a/b — int, длиннее не компилируем
+
+/// кусок программы, который повторяется count раз подряд (ищет find_loops)
+struct Loop {
+    long start, len, count;
+};
+
+struct Program {
+    struct Cmd *cmds;
+    long n, cap;
+    struct Loop *loops; // по возрастанию start, не пересекаются
+    long nloops;
+    struct Proc *procs;
+    long nprocs, proc_cap;
+    char **paths; // файлы для SAVE/LOAD, без повторов
+    long npaths, path_cap;
+    long saves;   // сколько SAVE: с ними повторы не проматываем, файлы пишутся честно
+    // пока компилируем: открытые REPEAT/DEF (номер команды, строка и столбец)
+    long *blocks, *block_lines, *block_cols;
+    long nblocks, block_cap;
+    long lines;      // сколько строк скомпилировано
+    long err_line;   // строка с ошибкой, 0 если ошибки нет
+    long err_col;    // столбец (в байтах, с 1), 0 если ошибка не к месту в строке
+    char err[96];
+};
+
+
+/// одна симуляция: поле + программа + где мы сейчас
+struct Sim {
+    struct Field field;
+    const struct Program *prog;
+    long pc;     // следующая команда
+    long steps;  // сколько команд-действий выполнено (управление не считается)
+    int status;  // DinoStatus
+    long *calls; // адреса возврата
+    long ncalls, call_cap;
+    long *reps;  // сколько проходов осталось у открытых REPEAT
+    long nreps, rep_cap;
+    // режим поиска циклов: повторы состояния на границах Loop проматываются целыми периодами
+    int cycles;
+    long skipped; // сколько шагов промотано, а не выполнено
+    struct History *hist; // если не NULL — пишем историю (подключать до первого шага)
+};
+
+/// изменение одной клетки: plane 0 — tiles, 1 — colors
+struct CellDelta {
+    int x, y;
+    char plane, old, now;
+};
+
+/// что стало после шага: где дино и где кончаются его изменения клеток
+struct StepRec {
+    long cells_end; // изменения шага i — cells[recs[i-1].cells_end, recs[i].cells_end)
+    int dino_x, dino_y;
+    char has_dino;
+    char reset;     // SIZE пересоздал поле — назад только через снимок
+};
+
+/// полная копия поля после шага step
+struct FieldSnap {
+    long step;
+    int w, h;
+    char *tiles, *colors; // w*h, построчно
+};
+
+/// история прогона: шаги, изменения клеток и снимки каждые every шагов
+struct History {
+    long every;
+    struct StepRec *recs; // recs[0] — до первого шага
+    long nrecs, rec_cap;
+    struct CellDelta *cells;
+    long ncells, cell_cap;
+    struct FieldSnap *snaps; // по возрастанию step
+    long nsnaps, snap_cap;
+    int failed; // не хватило памяти, история неполная
+};
+
+//ПОЛЕ
+int init_field(struct Field *f, int w, int h);
+void free_field(struct Field *f);
+void set_tile(struct Field *f, int x, int y, char c);
+void set_color(struct Field *f, int x, int y, char c);
+void zobrist_on(struct Field *f);
+void print_field(struct Field *f);
+void fprint_field(FILE *out, struct Field *f);
+int save_field(const struct Field *f, const char *path);
+int load_field(struct Field *f, const char *path);
+
+//ДИНО (move_dino и jump_dino возвращают DINO_FELL, если дино упал)
+int place_dino(struct Field *f, int x, int y);
+int move_dino(struct Field *f, int dir);
+int jump_dino(struct Field *f, int dir, int jum);
+void dig_dino(struct Field *f, int dir);
+void mound_dino(struct Field *f, int dir);
+void grow_dino(struct Field *f, int dir);
+void paint_cell(struct Field *f, char color);
+void cut_dino(struct Field *f, int dir);
+void make_dino(struct Field *f, int dir);
+void push_dino(struct Field *f, int dir);
+int goto_dino(struct Field *f, int x, int y);
+
+//ОБЛАСТИ (x, y — угол, дальше по тору; w, h обрезаются по размеру поля).
+//FILL берёт только клетки _ % ^ & @ и не ставит препятствие под дино, PAINT RECT — видимые ASCII
+void fill_rect(struct Field *f, int x, int y, int w, int h, char c);
+void paint_rect(struct Field *f, int x, int y, int w, int h, char c);
+void clear_rect(struct Field *f, int x, int y, int w, int h);
+
+//ПРОГРАММЫ
+int parse_dir(const char *s);
+int parse_cmd(const char *line, struct Cmd *c);
+int compile_line(struct Program *p, const char *line);
+int compile_program(struct Program *p, const char *text);
+int finish_program(struct Program *p);
+int load_program(struct Program *p, const char *path);
+void free_program(struct Program *p);
+void fprint_program_error(FILE *out, const char *path, const struct Program *p);
+int find_loops(struct Program *p);
+int exec_cmd(struct Field *f, const struct Cmd *c);
+int Comands_din(char *line, struct Field *f);
+
+//СИМУЛЯЦИЯ
+void init_sim(struct Sim *s, const struct Program *p);
+int step_sim(struct Sim *s);
+int run_sim(struct Sim *s, long max_steps);
+void print_frames(struct Sim *s, FILE *out);
+void detach_history(struct Sim *s);
+void free_sim(struct Sim *s);
+uint64_t hash_field(const struct Field *f);
+
+//ИСТОРИЯ
+void init_history(struct History *h, long every);
+void free_history(struct History *h);
+int seek_field(const struct History *h, long step, struct Field *f);
+int step_back_field(const struct History *h, struct Field *f, long *step);
+
+//ПРОФИЛЬ
+/// счётчики по командам и по исходам; время команд меряется выборочно
+/// (примерно каждая PROFILE_SAMPLE-я) и домножается, чтобы таймер почти ничего не стоил
+#define PROFILE_SAMPLE 64
+
+struct Profile {
+    uint64_t count[OP_COUNT];   // сколько раз выполнена
+    uint64_t ns[OP_COUNT];      // оценка общего времени
+    uint64_t sampled[OP_COUNT]; // сколько раз реально замерили
+    uint64_t rng;
+    uint64_t parse_ns, parse_lines;
+    uint64_t frames, render_bytes, render_ns;
+    uint64_t jump_cells;        // клеток пролетели прыжки
+    uint64_t falls;             // упал в яму (MOVE, JUMP, FILL)
+    uint64_t move_blocked;      // упёрся в гору/дерево/камень
+    uint64_t jump_blocked;      // прыжок оборвался о препятствие
+    uint64_t push_none, push_blocked, push_pit, push_moved;
+    uint64_t skipped;           // шагов промотано поиском циклов
+};
+
+uint64_t now_ns(void);
+const char *op_name(int op);
+void fprint_profile(FILE *out, const struct Profile *p, int json);
+
+//ТРАССА КАДРОВ
+/// вывод прогона (кадры print_field и сообщения) в сжатом файле: каждый кадр — XOR
+/// с прошлым, нули свёрнуты в (0, длина), а весь поток режется на блоки по
+/// TRACE_BLOCK байт и сжимается Хаффманом из huffman_lab2.c
+#define TRACE_BLOCK (256 * 1024)
+
+struct Trace {
+    FILE *f;
+    int writing, failed;
+    unsigned char *prev, *frame; // прошлый и текущий кадр
+    size_t prev_len, frame_cap, prev_cap;
+    unsigned char *msg;          // сообщения шага при чтении
+    size_t msg_cap;
+    unsigned char *block;        // поток до сжатия (или после разжатия)
+    size_t block_len, block_pos;
+    uint64_t frames, raw_bytes;  // raw_bytes — сколько напечатал бы обычный прогон
+};
+
+size_t render_field(const struct Field *f, char *out);
+int open_trace(struct Trace *t, const char *path, int writing);
+int trace_frame(struct Trace *t, const struct Field *f, const char *msg, size_t msg_len);
+int read_frame(struct Trace *t, const char **msg, size_t *msg_len, const char **frame, size_t *len);
+int close_trace(struct Trace *t);
+int record_frames(struct Sim *s, struct Trace *t);
+int replay_frames(struct Trace *t, FILE *out);
+
+//ГЕНЕРАТОР ПРОГРАММ
+/// случайная, но воспроизводимая по seed программа: SIZE, START, потом len команд.
+/// DIG всегда идёт в паре с MOUND туда же, так что ям не остаётся и дино не падает
+enum GenMix { MIX_MIXED, MIX_JUMP, MIX_PUSH, MIX_PAINT, MIX_COUNT };
+
+struct GenOpts {
+    uint64_t seed;
+    int w, h;  // для SIZE (exec_cmd всё равно обрежет до 10..100)
+    long len;  // сколько команд после SIZE и START
+    int mix;   // GenMix
+};
+
+struct Gen {
+    struct GenOpts o;
+    uint64_t rng;
+    long line;
+    int pending_mound; // после DIG следующая строка — MOUND в ту же сторону
+};
+
+void init_gen(struct Gen *g, const struct GenOpts *o);
+int gen_line(struct Gen *g, char *buf, size_t n);
+int gen_mix(const char *name);
+const char *gen_mix_name(int mix);
+
+//ТОЛПА ДИНО
+struct AgentPlan;
+
+/// много дино на одном поле, у каждого своя программа и свой pc.
+/// тик: все агенты планируют действие по полю на начало тика (параллельно),
+/// потом планы применяются по порядку номеров: клетку получает агент с меньшим
+/// номером, в клетку, где стоит другой дино, нельзя ни встать, ни что-то в ней
+/// поменять. итог не зависит от числа потоков
+struct Crowd {
+    struct Field field; // общее поле
+    struct Sim *agents; // от Sim.field у агента только dino_x/dino_y/has_dino
+    int n, cap;
+    int threads;
+    long ticks;
+    int *occ;   // w*h: номер агента + 1, 0 — клетка свободна
+    int *claim; // w*h: кто первым застолбил клетку в этом тике, -1 — никто
+    struct AgentPlan *plans;
+};
+
+void init_crowd(struct Crowd *c, int threads);
+int add_agent(struct Crowd *c, const struct Program *p, int x, int y);
+int tick_crowd(struct Crowd *c);
+long run_crowd(struct Crowd *c, long max_ticks);
+void fprint_crowd(FILE *out, const struct Crowd *c);
+void free_crowd(struct Crowd *c);
+
+//ПАЧКА ПРОГРАММ
+/// итог одной программы из пачки
+#define BATCH_UNREADABLE (-1) // файл не открылся: причина в err_no
+#define BATCH_SYNTAX     (-2) // не скомпилировалось: где и что — в err_line, err_col, err
+
+struct BatchResult {
+    int status;     // DinoStatus или BATCH_UNREADABLE, BATCH_SYNTAX
+    int has_dino;
+    int x, y;       // где остался дино
+    long steps;
+    uint64_t hash;  // hash_field итогового поля
+    int err_no;              // ошибка программы, как в struct Program
+    long err_line, err_col;
+    char err[96];
+};
+
+int run_batch(char **paths, int n, int threads, struct BatchResult *res);
+
+#endif
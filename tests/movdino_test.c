@@ -0,0 +1,784 @@
+/// проверки поведения движка: собирается вместе с movdino.c одним файлом
+///   gcc tests/movdino_test.c -o movdino_test -lpthread
+///   ./movdino_test            (из корня репозитория; или ./movdino_test <корень>)
+#define MOVDINO_NO_MAIN
+#include "../movdino.c"
+
+static int failures, checks;
+static const char *root = ".";
+
+#define CHECK(cond, ...) do {                                   \
+    checks++;                                                   \
+    if (!(cond)) {                                              \
+        failures++;                                             \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);         \
+        fprintf(stderr, __VA_ARGS__);                           \
+        fprintf(stderr, "\n");                                  \
+    }                                                           \
+} while (0)
+
+static char *root_path(const char *name) {
+    static char buf[4096];
+    snprintf(buf, sizeof(buf), "%s/%s", root, name);
+    return buf;
+}
+
+/// весь файл в память (с '\0' в конце); NULL если не читается
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    char *s = read_all(f, len);
+    fclose(f);
+    if (s) {
+        char *t = realloc(s, *len + 1);
+        if (!t) free(s);
+        s = t;
+    }
+    if (s) s[*len] = '\0';
+    return s;
+}
+
+/// что осталось в tmpfile с начала
+static char *drain(FILE *f, size_t *len) {
+    rewind(f);
+    return read_all(f, len);
+}
+
+/// программа из текста; 0 если не скомпилировалась
+static int compile_text_program(struct Program *p, const char *text) {
+    memset(p, 0, sizeof(*p));
+    if (compile_program(p, text)) return 1;
+    fprintf(stderr, "не скомпилировалось: %ld:%ld: %s\n", p->err_line, p->err_col, p->err);
+    return 0;
+}
+
+/// текст из строки body, повторённой times раз (после заголовка head)
+static char *repeat_text(const char *head, const char *body, int times) {
+    size_t hl = strlen(head), bl = strlen(body);
+    char *s = malloc(hl + bl * times + 1);
+    if (!s) return NULL;
+    memcpy(s, head, hl);
+    for (int i = 0; i < times; i++) memcpy(s + hl + bl * i, body, bl);
+    s[hl + bl * times] = '\0';
+    return s;
+}
+
+/// случайная программа из --gen одним текстом
+static char *gen_text(uint64_t seed, long len, int mix) {
+    struct GenOpts o = { seed, 30, 20, len, mix };
+    struct Gen g;
+    char line[64];
+    size_t n = 0, cap = 1 << 12;
+    char *s = malloc(cap);
+
+    init_gen(&g, &o);
+    while (s && gen_line(&g, line, sizeof(line))) {
+        size_t k = strlen(line);
+        if (n + k + 2 > cap) {
+            char *t = realloc(s, cap *= 2);
+            if (!t) free(s);
+            s = t;
+            if (!s) break;
+        }
+        memcpy(s + n, line, k);
+        s[n + k] = '\n';
+        n += k + 1;
+    }
+    if (s) s[n] = '\0';
+    return s;
+}
+
+/// чем кончился прогон
+struct RunEnd {
+    long steps;
+    int status, has_dino, x, y;
+    uint64_t hash;
+};
+
+/// прогон не больше budget шагов; cycles — с проматыванием повторов, как --cycles
+static struct RunEnd run_budget(struct Program *p, int cycles, long budget) {
+    struct Sim sim;
+    struct RunEnd r;
+    init_sim(&sim, p);
+    if (cycles) {
+        sim.cycles = 1;
+        zobrist_on(&sim.field);
+    }
+    r.status = run_sim(&sim, budget);
+    r.steps = sim.steps;
+    r.has_dino = sim.field.has_dino;
+    r.x = sim.field.dino_x;
+    r.y = sim.field.dino_y;
+    r.hash = hash_field(&sim.field);
+    free_sim(&sim);
+    return r;
+}
+
+static int same_end(const struct RunEnd *a, const struct RunEnd *b) {
+    return a->steps == b->steps && a->status == b->status && a->has_dino == b->has_dino
+        && a->x == b->x && a->y == b->y && a->hash == b->hash;
+}
+
+///ЭТАЛОННЫЙ ВЫВОД
+/// program.txt.txt печатает ровно то, что лежит в tests/program.expected
+static void test_sample_golden(void) {
+    size_t want_len, got_len;
+    char *want = read_file(root_path("tests/program.expected"), &want_len);
+    CHECK(want, "нет tests/program.expected");
+
+    struct Program prog = {0};
+    int ok = load_program(&prog, root_path("program.txt.txt"));
+    CHECK(ok, "program.txt.txt не загрузилась");
+    if (!want || !ok) {
+        free(want);
+        free_program(&prog);
+        return;
+    }
+
+    struct Sim sim;
+    FILE *out = tmpfile();
+    init_sim(&sim, &prog);
+    print_frames(&sim, out);
+    char *got = drain(out, &got_len);
+    fclose(out);
+
+    size_t i = 0;
+    while (i < want_len && i < got_len && want[i] == got[i]) i++;
+    CHECK(got && got_len == want_len && i == want_len,
+          "вывод program.txt.txt разошёлся с эталоном на байте %zu (%zu против %zu байт)", i, got_len, want_len);
+
+    free(got);
+    free(want);
+    free_sim(&sim);
+    free_program(&prog);
+}
+
+///ПРОМАТЫВАНИЕ ПОВТОРОВ
+/// --cycles с ограничением шагов останавливается там же, где обычный прогон
+static void check_cycles_budget(const char *name, const char *text, long max_budget) {
+    struct Program p;
+    if (!compile_text_program(&p, text) || !find_loops(&p)) {
+        CHECK(0, "%s: не скомпилировалось", name);
+        free_program(&p);
+        return;
+    }
+    int bad = 0;
+    for (long budget = 1; budget <= max_budget; budget++) {
+        struct RunEnd plain = run_budget(&p, 0, budget), fast = run_budget(&p, 1, budget);
+        if (!same_end(&plain, &fast) && bad++ < 3)
+            CHECK(0, "%s, бюджет %ld: обычный прогон %ld шагов, --cycles %ld", name, budget, plain.steps, fast.steps);
+    }
+    CHECK(bad == 0, "%s: расхождений %d из %ld бюджетов", name, bad, max_budget);
+
+    struct RunEnd plain = run_budget(&p, 0, -1), fast = run_budget(&p, 1, -1);
+    CHECK(same_end(&plain, &fast), "%s: без ограничения %ld против %ld шагов", name, plain.steps, fast.steps);
+    free_program(&p);
+}
+
+static void test_cycles(void) {
+    char *flat = repeat_text("SIZE 20 10\nSTART 0 0\n", "MOVE RIGHT\nPAINT G\n", 400);
+    if (flat) check_cycles_budget("MOVE/PAINT x400", flat, 801);
+    free(flat);
+
+    check_cycles_budget("REPEAT",
+                        "SIZE 12 12\nSTART 1 1\nREPEAT 50\nMOVE RIGHT\nREPEAT 3\nPAINT R\nMOVE DOWN\nEND\nEND\nMOVE UP\n",
+                        220);
+    check_cycles_budget("CALL в REPEAT",
+                        "DEF step\nMOVE LEFT\nGROW UP\nCUT UP\nEND\nSIZE 10 10\nSTART 5 5\nREPEAT 40\nCALL step\nPAINT B\nEND\n",
+                        170);
+}
+
+///ИСТОРИЯ
+/// состояние поля, которое видно снаружи: клетки, краски и дино
+struct FieldKey {
+    uint64_t hash;
+    int has_dino, x, y;
+};
+
+static struct FieldKey field_key(const struct Field *f) {
+    struct FieldKey k = { hash_field(f), f->has_dino, f->dino_x, f->dino_y };
+    return k;
+}
+
+static int same_key(struct FieldKey a, struct FieldKey b) {
+    return a.hash == b.hash && a.has_dino == b.has_dino && (!a.has_dino || (a.x == b.x && a.y == b.y));
+}
+
+/// seek_field(k) и шаги назад от конца дают то же поле, что честный прогон после k шагов
+static void check_seek(const char *name, const char *text, long every) {
+    struct Program p;
+    if (!compile_text_program(&p, text)) {
+        CHECK(0, "%s: не скомпилировалось", name);
+        return;
+    }
+
+    // честный прогон: поле после каждого шага
+    struct Sim sim;
+    long n = 0, cap = 64;
+    struct FieldKey *keys = malloc(cap * sizeof(*keys));
+    init_sim(&sim, &p);
+    keys[n++] = field_key(&sim.field);
+    while (keys && sim.status == DINO_RUNNING) {
+        long before = sim.steps;
+        step_sim(&sim);
+        if (sim.steps == before) break;
+        if (n == cap) {
+            struct FieldKey *k = realloc(keys, (cap *= 2) * sizeof(*keys));
+            if (!k) free(keys);
+            keys = k;
+            if (!keys) break;
+        }
+        keys[n++] = field_key(&sim.field);
+    }
+    free_sim(&sim);
+
+    struct History hist;
+    struct Field view = {0};
+    init_history(&hist, every);
+    init_sim(&sim, &p);
+    sim.hist = &hist;
+    run_sim(&sim, -1);
+    CHECK(keys && !hist.failed && sim.steps == n - 1, "%s: с историей %ld шагов, без неё %ld", name, sim.steps, n - 1);
+
+    int bad = 0;
+    for (long k = 0; keys && k < n && k < hist.nrecs; k++)
+        if (!seek_field(&hist, k, &view) || !same_key(field_key(&view), keys[k])) bad++;
+    CHECK(bad == 0, "%s: seek_field не совпал на %d шагах из %ld", name, bad, n);
+
+    long step = n - 1;
+    bad = 0;
+    if (keys && seek_field(&hist, step, &view))
+        while (step > 0 && step_back_field(&hist, &view, &step))
+            if (!same_key(field_key(&view), keys[step])) bad++;
+    CHECK(bad == 0 && step == 0, "%s: шаги назад разошлись %d раз, остановились на шаге %ld", name, bad, step);
+
+    if (view.tiles) free_field(&view);
+    detach_history(&sim);
+    free_history(&hist);
+    free_sim(&sim);
+    free_program(&p);
+    free(keys);
+}
+
+/// историю отключили и освободили посреди прогона: дальше шаги идут без неё и
+/// кончаются там же, где без истории вовсе (под ASan — без записи в освобождённое)
+static void check_detach(const char *name, const char *text, long at) {
+    struct Program p;
+    if (!compile_text_program(&p, text)) {
+        CHECK(0, "%s: не скомпилировалось", name);
+        return;
+    }
+    struct RunEnd want = run_budget(&p, 0, -1);
+
+    struct Sim sim;
+    struct History *hist = malloc(sizeof(*hist));
+    init_sim(&sim, &p);
+    if (hist) {
+        init_history(hist, 16);
+        sim.hist = hist;
+        run_sim(&sim, at);
+        detach_history(&sim);
+        free_history(hist);
+        free(hist);
+    }
+    CHECK(sim.field.log == NULL, "%s: field.log смотрит в отключённую историю", name);
+    run_sim(&sim, -1);
+    CHECK(sim.steps == want.steps && sim.status == want.status && hash_field(&sim.field) == want.hash,
+          "%s: после отключения истории %ld шагов вместо %ld", name, sim.steps, want.steps);
+    free_sim(&sim);
+    free_program(&p);
+}
+
+static void test_seek(void) {
+    check_seek("SIZE посреди программы",
+               "SIZE 10 10\nSTART 2 2\nPAINT R\nMOVE RIGHT\nFILL 0 0 3 3 ^\nSIZE 12 11\nSTART 1 1\n"
+               "REPEAT 9\nDIG DOWN\nMOUND LEFT\nMOVE RIGHT\nPAINT G\nEND\nPAINT RECT 4 4 20 3 B\nCLEAR 5 0 3 30\nJUMP LEFT 3\n",
+               4);
+    for (int mix = 0; mix < MIX_COUNT; mix++) {
+        char *text = gen_text(100 + mix, 3000, mix);
+        if (text) check_seek(gen_mix_name(mix), text, 64);
+        if (text) check_detach(gen_mix_name(mix), text, 1500);
+        free(text);
+    }
+}
+
+///ОБЛАСТИ
+/// программа не компилируется, а ошибка стоит в строке line, столбце col
+static void check_error(const char *text, long line, long col) {
+    struct Program p = {0};
+    int ok = compile_program(&p, text);
+    CHECK(!ok && p.err_line == line && p.err_col == col, "«%s»: ждали ошибку в %ld:%ld, а вышло %s %ld:%ld %s",
+          text, line, col, ok ? "успех" : "ошибка", p.err_line, p.err_col, p.err);
+    free_program(&p);
+}
+
+static void test_regions(void) {
+    check_error("SIZE 10 10\nFILL 1 2 3 4\n", 2, 13);
+    check_error("FILL 1 2 3 4 Z\n", 1, 14);
+    check_error("FILL 1 2 x 4 ^\n", 1, 10);
+    check_error("PAINT RECT 1 1 2 2\n", 1, 19);
+    check_error("PAINT RECT 0 0 1\n", 1, 17);
+    check_error("CLEAR 1 2\n", 1, 10);
+
+    struct Program p;
+    if (compile_text_program(&p, "CLEAR\nCLEAR 1 2 3 4\nFILL 0 0 3 3 @\nPAINT RECT 5 5 2 2 R\n")) {
+        CHECK(p.n == 4 && p.cmds[0].w == INT_MAX && p.cmds[1].w == 3 && p.cmds[2].c == '@' && p.cmds[3].c == 'R',
+              "области разобрались не так");
+        free_program(&p);
+    }
+
+    // гора поверх дино: все клетки кроме его
+    struct Field f = {0};
+    init_field(&f, 12, 10);
+    zobrist_on(&f);
+    place_dino(&f, 4, 4);
+    CHECK(exec_cmd(&f, &(struct Cmd){ .op = OP_FILL, .a = 2, .b = 2, .w = 5, .h = 5, .c = '^' }) == DINO_RUNNING,
+          "FILL горой уронил дино");
+    CHECK(f.tiles[4][4] == '_' && f.tiles[4][5] == '^' && f.tiles[2][2] == '^', "FILL горой закопал дино");
+    CHECK(!(f.row_block[4 * f.row_words] >> 4 & 1) && !(f.col_block[4 * f.col_words] >> 4 & 1),
+          "клетка дино в индексе препятствий");
+    CHECK(f.zhash == full_zhash(&f), "хеш разошёлся после FILL");
+
+    // пустые и чужие символы в поле не попадают
+    fill_rect(&f, 0, 0, 3, 3, '\0');
+    paint_rect(&f, 0, 0, 3, 3, '\0');
+    CHECK(f.tiles[0][0] == '_' && f.colors[0][0] == ' ', "FILL/PAINT RECT записали нулевой символ");
+
+    CHECK(exec_cmd(&f, &(struct Cmd){ .op = OP_FILL, .a = 4, .b = 4, .w = 1, .h = 1, .c = '%' }) == DINO_FELL,
+          "яма под дино должна ронять");
+    free_field(&f);
+}
+
+///GOTO
+/// эталон: обход в ширину по тору от дино, шагов до цели или -1
+static int torus_dist(const struct Field *f, int sx, int sy, int tx, int ty) {
+    int w = f->w, n = f->w * f->h;
+    int *dist = malloc(n * sizeof(int)), *queue = malloc(n * sizeof(int));
+    int head = 0, tail = 0, found = -1;
+    if (!dist || !queue) {
+        free(dist);
+        free(queue);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) dist[i] = -1;
+    dist[sy * w + sx] = 0;
+    queue[tail++] = sy * w + sx;
+    while (head < tail && found < 0) {
+        int u = queue[head++], x = u % w, y = u / w;
+        if (x == tx && y == ty) found = dist[u];
+        for (int dir = DIR_UP; dir <= DIR_RIGHT; dir++) {
+            int nx = x, ny = y;
+            step_dir((struct Field *)f, dir, &nx, &ny);
+            int v = ny * w + nx;
+            if (dist[v] >= 0 || !passable(f, nx, ny)) continue;
+            dist[v] = dist[u] + 1;
+            queue[tail++] = v;
+        }
+    }
+    free(dist);
+    free(queue);
+    return found;
+}
+
+/// сколько шагов до (tx, ty) насчитал GOTO из (sx, sy): берём его поле расстояний из кеша
+static int goto_dist(struct Field *f, int sx, int sy, int tx, int ty) {
+    if (sx == tx && sy == ty) return 0;
+    for (int i = 0; f->paths && i < PATH_CACHE_SIZE; i++) {
+        struct PathEntry *e = &f->paths->e[i];
+        int bx, by;
+        if (e->dist && e->tx == tx && e->ty == ty && e->ver == f->pass_ver) {
+            int d = best_step(f, e->dist, sx, sy, &bx, &by);
+            return d < 0 ? -1 : d + 1;
+        }
+    }
+    return -1;
+}
+
+/// GOTO из (sx, sy) в (tx, ty): сверяет исход, место и длину пути с эталоном; сообщения — в msg
+static void check_goto(const char *name, struct Field *f, int sx, int sy, int tx, int ty) {
+    int want = torus_dist(f, sx, sy, tx, ty);
+    place_dino(f, sx, sy);
+    int ok = goto_dino(f, tx, ty);
+    CHECK(ok == (want >= 0), "%s: GOTO %d %d вернул %d, а путь %d", name, tx, ty, ok, want);
+    CHECK(ok ? f->dino_x == tx && f->dino_y == ty : f->dino_x == sx && f->dino_y == sy,
+          "%s: дино в %d,%d", name, f->dino_x, f->dino_y);
+    if (ok) CHECK(goto_dist(f, sx, sy, tx, ty) == want, "%s: путь %d шагов, а кратчайший %d", name,
+                  goto_dist(f, sx, sy, tx, ty), want);
+}
+
+static void test_goto(void) {
+    struct Field f = {0};
+    FILE *msg = tmpfile();
+    size_t len;
+
+    // стена из всех непроходимых клеток поперёк поля: путь только через край
+    init_field(&f, 12, 8);
+    f.msg = msg;
+    for (int y = 0; y < f.h; y++) set_tile(&f, 4, y, "^&@%"[y % 4]);
+    set_tile(&f, 0, 3, '@');
+    check_goto("через край", &f, 2, 3, 7, 3);
+    CHECK(goto_dist(&f, 2, 3, 7, 3) == 9, "через край: %d шагов вместо 9", goto_dist(&f, 2, 3, 7, 3));
+
+    // яма в цели и цель, отрезанная со всех сторон: дино стоит, сообщение есть
+    set_tile(&f, 9, 6, '%');
+    check_goto("яма в цели", &f, 2, 3, 9, 6);
+    for (int dir = DIR_UP; dir <= DIR_RIGHT; dir++) {
+        int x = 9, y = 1;
+        step_dir(&f, dir, &x, &y);
+        set_tile(&f, x, y, '^');
+    }
+    check_goto("замурованная цель", &f, 2, 3, 9, 1);
+    char *text = msg ? drain(msg, &len) : NULL;
+    CHECK(text && len == 2 * strlen("Туда не пройти!\n") && memcmp(text, "Туда не пройти!\nТуда не пройти!\n", len) == 0,
+          "ждали два «Туда не пройти!», а вышло «%s»", text ? text : "");
+    free(text);
+
+    // проходимость поменялась — старое поле расстояний не годится
+    uint64_t ver = f.pass_ver;
+    set_color(&f, 5, 5, 'R');
+    CHECK(f.pass_ver == ver, "краска не меняет проходимость");
+    check_goto("до стены", &f, 2, 3, 7, 5);
+    set_tile(&f, 4, 5, '_'); // пролом в стене: короче, чем через край
+    CHECK(f.pass_ver != ver, "пролом в стене не сменил pass_ver");
+    check_goto("после пролома", &f, 2, 3, 7, 5);
+    CHECK(goto_dist(&f, 2, 3, 7, 5) == 7, "после пролома: %d шагов вместо 7", goto_dist(&f, 2, 3, 7, 5));
+    set_tile(&f, 4, 5, '@');
+    for (int y = 0; y < f.h; y++) set_tile(&f, 0, y, '^'); // и край закрыт
+    check_goto("стена снова целая", &f, 2, 3, 7, 5);
+    free_field(&f);
+
+    // случайные поля против эталона
+    uint64_t rng = 77;
+    for (int k = 0; k < 300; k++) {
+        init_field(&f, 5 + k % 9, 4 + k % 7);
+        for (int y = 0; y < f.h; y++)
+            for (int x = 0; x < f.w; x++) {
+                rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+                if ((rng >> 40) % 10 < 3) set_tile(&f, x, y, "^&@%"[(rng >> 20) % 4]);
+            }
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        int sx = (int)(rng >> 33) % f.w, sy = (int)(rng >> 45) % f.h;
+        int tx = (int)(rng >> 13) % f.w, ty = (int)(rng >> 23) % f.h;
+        set_tile(&f, sx, sy, '_');
+        check_goto("случайное поле", &f, sx, sy, tx, ty);
+        free_field(&f);
+    }
+    if (msg) fclose(msg);
+}
+
+///РАЗБОР СТРОК
+/// незнакомые слова и направления — ошибки с местом, пустые строки — по-прежнему кадры
+static void test_scanner(void) {
+    check_error("SIZE 10 10\nSTART 1 1\nMOVE RIGTH\n", 3, 6);
+    check_error("SIZE 10 10\n  JUMPP UP 2\n", 2, 3);
+    check_error("JUMP\n", 1, 5);
+    check_error("JUMP 3 UP\n", 1, 6);
+    check_error("DIG\tdown\n", 1, 5);
+    check_error("REPEAT 2\nmove LEFT\nEND\n", 2, 1);
+    check_error("SIZE 10 10\nSTART 1 1\nPAINT\n", 3, 6);
+    check_error("PAINT   \n", 1, 9);
+    check_error("PAINT \x7f\n", 1, 7);
+
+    struct Program p;
+    if (compile_text_program(&p, "SIZE 10 10\r\n\r\n   \nMOVE RIGHT\r\nJUMP UP\n")) {
+        CHECK(p.n == 5 && p.cmds[1].op == OP_NOP && p.cmds[2].op == OP_NOP && p.cmds[3].dir == DIR_RIGHT
+              && p.cmds[4].op == OP_JUMP && p.cmds[4].a == 0, "строки разобрались не так");
+        free_program(&p);
+    }
+
+    // краска мимо разбора (старый путь, библиотека) в поле всё равно не попадает
+    struct Field f = {0};
+    init_field(&f, 10, 10);
+    place_dino(&f, 2, 3);
+    paint_cell(&f, '\0');
+    CHECK(f.colors[3][2] == ' ', "PAINT записал нулевой символ");
+    CHECK(Comands_din("PAINT", &f) == DINO_RUNNING && f.colors[3][2] == ' ', "PAINT без краски что-то покрасил");
+    free_field(&f);
+}
+
+///ОБРАЗЫ ПОЛЯ
+static int same_blocks(const struct Field *a, const struct Field *b) {
+    return a->w == b->w && a->h == b->h && a->row_words == b->row_words && a->col_words == b->col_words
+        && memcmp(a->row_block, b->row_block, (size_t)a->h * a->row_words * sizeof(uint64_t)) == 0
+        && memcmp(a->col_block, b->col_block, (size_t)a->w * a->col_words * sizeof(uint64_t)) == 0;
+}
+
+/// испорченный индекс и хеш в образе не влияют: после загрузки они собраны из клеток
+static void test_image(void) {
+    const char *path = "movdino_test.img";
+    struct Field want = {0}, got = {0};
+    init_field(&want, 70, 12); // строка длиннее одного слова битов
+    fill_rect(&want, 3, 2, 5, 4, '^');
+    fill_rect(&want, 66, 0, 2, 12, '@');
+    paint_rect(&want, 0, 0, 4, 4, 'R');
+    place_dino(&want, 10, 5);
+    CHECK(save_field(&want, path), "не записался %s", path);
+
+    // руками: мусор в битах, чужой хеш и новая гора в клетках
+    FILE *f = fopen(path, "r+b");
+    CHECK(f != NULL, "не открылся %s", path);
+    if (f) {
+        struct FieldImage hd;
+        CHECK(fread(&hd, sizeof(hd), 1, f) == 1, "не прочитался заголовок");
+        hd.zhash ^= 0x5555;
+        size_t bits = ((size_t)hd.h * hd.row_words + (size_t)hd.w * hd.col_words) * sizeof(uint64_t);
+        char *junk = malloc(bits);
+        if (junk) memset(junk, 0xA5, bits);
+        fseek(f, 0, SEEK_SET);
+        fwrite(&hd, sizeof(hd), 1, f);
+        if (junk) fwrite(junk, 1, bits, f);
+        free(junk);
+        fseek(f, (long)(sizeof(hd) + bits + 5 * 70 + 40), SEEK_SET); // клетка (40, 5)
+        fputc('@', f);
+        fclose(f);
+    }
+    set_tile(&want, 40, 5, '@');
+
+    CHECK(load_field(&got, path), "образ не загрузился");
+    if (got.tiles) {
+        CHECK(same_blocks(&got, &want), "индекс препятствий после загрузки не совпал с клетками");
+        CHECK(got.zhash == full_zhash(&want), "хеш после загрузки не пересчитан");
+        jump_dino(&want, DIR_RIGHT, 40);
+        jump_dino(&got, DIR_RIGHT, 40);
+        CHECK(got.dino_x == want.dino_x && got.dino_y == want.dino_y,
+              "JUMP по загруженному образу: %d,%d вместо %d,%d", got.dino_x, got.dino_y, want.dino_x, want.dino_y);
+        free_field(&got);
+    }
+
+    // сохранение поверх своего же образа: отображённые клетки не пропадают, файл цел
+    if (load_field(&got, path)) {
+        set_tile(&got, 1, 1, '&');
+        CHECK(save_field(&got, path), "не записался образ поверх загруженного");
+        set_tile(&want, 1, 1, '&');
+        int same = 1;
+        for (int y = 0; y < want.h; y++) same &= memcmp(got.tiles[y], want.tiles[y], want.w) == 0;
+        CHECK(same, "клетки загруженного поля испортились после сохранения в тот же файл");
+        free_field(&got);
+        CHECK(load_field(&got, path) && got.tiles && got.tiles[1][1] == '&' && got.tiles[5][40] == '@',
+              "образ после сохранения поверх себя не читается");
+        if (got.tiles) free_field(&got);
+    }
+    free_field(&want);
+    remove(path);
+}
+
+///ТРАССА
+/// --record и --replay печатают то же, что обычный прогон, вместе с сообщениями
+static void check_trace(const char *name, const char *text) {
+    const char *path = "movdino_test.trc";
+    struct Program p;
+    if (!compile_text_program(&p, text)) {
+        CHECK(0, "%s: не скомпилировалось", name);
+        return;
+    }
+
+    struct Sim sim;
+    struct Trace t;
+    size_t want_len = 0, got_len = 0;
+    FILE *out = tmpfile();
+    init_sim(&sim, &p);
+    print_frames(&sim, out);
+    char *want = drain(out, &want_len);
+    fclose(out);
+    free_sim(&sim);
+
+    init_sim(&sim, &p);
+    int ok = open_trace(&t, path, 1);
+    CHECK(ok, "%s: не открылась трасса на запись", name);
+    if (ok) {
+        ok = record_frames(&sim, &t);
+        ok = close_trace(&t) && ok;
+        CHECK(ok, "%s: трасса не записалась", name);
+    }
+    free_sim(&sim);
+
+    char *got = NULL;
+    if (ok && open_trace(&t, path, 0)) {
+        out = tmpfile();
+        int r = replay_frames(&t, out);
+        CHECK(r == 0, "%s: трасса не прочиталась (%d)", name, r);
+        CHECK(t.raw_bytes == want_len, "%s: raw_bytes %llu, а напечатано %zu", name,
+              (unsigned long long)t.raw_bytes, want_len);
+        close_trace(&t);
+        got = drain(out, &got_len);
+        fclose(out);
+    }
+    size_t i = 0;
+    while (want && got && i < want_len && i < got_len && want[i] == got[i]) i++;
+    CHECK(want && got && got_len == want_len && i == want_len,
+          "%s: повтор трассы разошёлся с прогоном на байте %zu (%zu против %zu байт)", name, i, got_len, want_len);
+
+    // обрезанная трасса — ошибка, а не тихий конец
+    size_t size;
+    char *bytes = got ? read_file(path, &size) : NULL;
+    FILE *f = bytes ? fopen(path, "wb") : NULL;
+    if (f) {
+        fwrite(bytes, 1, size - 3, f);
+        fclose(f);
+        if (open_trace(&t, path, 0)) {
+            out = tmpfile();
+            CHECK(replay_frames(&t, out) < 0, "%s: обрезанная трасса прочиталась целиком", name);
+            fclose(out);
+            close_trace(&t);
+        }
+    }
+    free(bytes);
+    free(got);
+    free(want);
+    free_program(&p);
+    remove(path);
+}
+
+static void test_trace(void) {
+    check_trace("JUMP в стену и падение",
+                "SIZE 8 4\nSTART 0 0\nFILL 3 0 1 4 ^\nJUMP RIGHT 5\nMOVE RIGHT\nJUMP RIGHT 4\nDIG DOWN\nMOVE DOWN\nMOVE DOWN\n");
+    for (int mix = 0; mix < MIX_COUNT; mix++) {
+        // у прыжков поток самый толстый: 12000 шагов — это пара блоков по TRACE_BLOCK
+        char *text = gen_text(200 + mix, mix == MIX_JUMP ? 12000 : 3000, mix);
+        if (text) check_trace(gen_mix_name(mix), text);
+        free(text);
+    }
+
+    // один символ на весь блок и перекошенные частоты
+    static unsigned char in[70000], back[70000];
+    FILE *f = tmpfile();
+    memset(in, '_', sizeof(in));
+    CHECK(f && huff_write_block(f, in, sizeof(in)), "блок из одного символа не записался");
+    for (size_t i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i % 97 == 0 ? i * 31 : i % 3);
+    CHECK(f && huff_write_block(f, in, sizeof(in)), "блок не записался");
+    if (f) {
+        rewind(f);
+        CHECK(huff_read_block(f, back, sizeof(back)) == (long long)sizeof(back) && back[0] == '_'
+              && back[sizeof(back) - 1] == '_', "блок из одного символа не прочитался");
+        CHECK(huff_read_block(f, back, sizeof(back)) == (long long)sizeof(back) && memcmp(in, back, sizeof(in)) == 0,
+              "блок прочитался не тем");
+        CHECK(huff_read_block(f, back, sizeof(back)) == 0, "после последнего блока не конец");
+        fclose(f);
+    }
+}
+
+///ТОЛПА
+#define CROWD_RANDOM 60
+
+/// чем кончилась толпа: поле, тики и каждый агент
+struct CrowdEnd {
+    uint64_t hash;
+    long ticks;
+    int n;
+    int x[CROWD_RANDOM + 4], y[CROWD_RANDOM + 4], status[CROWD_RANDOM + 4], has[CROWD_RANDOM + 4];
+};
+
+/// поле 30×20: камень '@' в (7,2), агенты 0 и 1 идут в одну клетку (3,5),
+/// агенты 2 и 3 толкают один камень с разных сторон; random — ещё столько случайных
+static struct CrowdEnd run_test_crowd(struct Program *progs, int nprogs, int threads, int random) {
+    struct Crowd c;
+    struct CrowdEnd r = {0};
+    init_crowd(&c, threads);
+    init_field(&c.field, 30, 20);
+    set_tile(&c.field, 7, 2, '@');
+    add_agent(&c, &progs[0], 2, 5);
+    add_agent(&c, &progs[1], 4, 5);
+    add_agent(&c, &progs[2], 6, 2);
+    add_agent(&c, &progs[3], 7, 1);
+    uint64_t rng = 12345;
+    for (int k = 0; k < random; ) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        int x = (int)(rng >> 33) % 30, y = 10 + (int)(rng >> 45) % 10;
+        if (add_agent(&c, &progs[4 + k % (nprogs - 4)], x, y)) k++;
+    }
+    run_crowd(&c, -1);
+
+    r.hash = hash_field(&c.field);
+    r.ticks = c.ticks;
+    r.n = c.n;
+    for (int i = 0; i < c.n; i++) {
+        r.x[i] = c.agents[i].field.dino_x;
+        r.y[i] = c.agents[i].field.dino_y;
+        r.has[i] = c.agents[i].field.has_dino;
+        r.status[i] = c.agents[i].status;
+    }
+    free_crowd(&c);
+    return r;
+}
+
+static int same_crowd(const struct CrowdEnd *a, const struct CrowdEnd *b) {
+    if (a->hash != b->hash || a->ticks != b->ticks || a->n != b->n) return 0;
+    for (int i = 0; i < a->n; i++)
+        if (a->x[i] != b->x[i] || a->y[i] != b->y[i] || a->has[i] != b->has[i] || a->status[i] != b->status[i])
+            return 0;
+    return 1;
+}
+
+/// итог толпы не зависит от числа потоков, спорную клетку получает меньший номер
+static void test_crowd(void) {
+    const char *texts[4] = { "MOVE RIGHT\n", "MOVE LEFT\n", "PUSH RIGHT\n", "PUSH DOWN\n" };
+    struct Program progs[4 + MIX_COUNT] = {{0}};
+    int ok = 1;
+    for (int i = 0; i < 4; i++) ok &= compile_text_program(&progs[i], texts[i]);
+    for (int mix = 0; mix < MIX_COUNT; mix++) {
+        char *text = gen_text(300 + mix, 400, mix);
+        ok &= text && compile_text_program(&progs[4 + mix], text);
+        free(text);
+    }
+    CHECK(ok, "программы толпы не скомпилировались");
+    if (ok) {
+        struct CrowdEnd r = run_test_crowd(progs, 4 + MIX_COUNT, 1, 0);
+        CHECK(r.x[0] == 3 && r.y[0] == 5 && r.x[1] == 4 && r.y[1] == 5,
+              "клетку (3,5) должен получить агент 0: агенты в %d,%d и %d,%d", r.x[0], r.y[0], r.x[1], r.y[1]);
+
+        struct Field want = {0};
+        init_field(&want, 30, 20);
+        set_tile(&want, 8, 2, '@');
+        CHECK(r.hash == hash_field(&want), "камень толкает агент 2 (вправо), а не агент 3 (вниз)");
+        free_field(&want);
+
+        struct CrowdEnd one = run_test_crowd(progs, 4 + MIX_COUNT, 1, CROWD_RANDOM);
+        int threads[] = { 2, 7, 64 };
+        for (int t = 0; t < 3; t++) {
+            struct CrowdEnd got = run_test_crowd(progs, 4 + MIX_COUNT, threads[t], CROWD_RANDOM);
+            CHECK(same_crowd(&one, &got), "толпа на %d потоках разошлась с одним потоком", threads[t]);
+        }
+    }
+    for (int i = 0; i < 4 + MIX_COUNT; i++) free_program(&progs[i]);
+}
+
+///ПАЧКА
+/// не открылась и не скомпилировалась — разные исходы, и причина остаётся в результате
+static void test_batch(void) {
+    const char *bad = "movdino_test_bad.txt";
+    FILE *f = fopen(bad, "wb");
+    if (f) {
+        fputs("SIZE 10 10\nJUMP SIDEWAYS 2\n", f);
+        fclose(f);
+    }
+    char *paths[] = { root_path("program.txt.txt"), (char *)bad, (char *)"movdino_test_missing.txt" };
+    struct BatchResult res[3];
+    int ok = run_batch(paths, 3, 2, res);
+    CHECK(ok, "пачка не запустилась");
+    if (ok) {
+        CHECK(res[0].status == DINO_FELL, "program.txt.txt в пачке: %d", res[0].status);
+        CHECK(res[1].status == BATCH_SYNTAX && res[1].err_line == 2 && res[1].err_col == 6,
+              "ошибка в программе: %d %ld:%ld", res[1].status, res[1].err_line, res[1].err_col);
+        CHECK(res[2].status == BATCH_UNREADABLE && res[2].err_no == ENOENT,
+              "нет файла: %d, errno %d", res[2].status, res[2].err_no);
+    }
+    remove(bad);
+}
+
+int main(int argn, char *args[]) {
+    if (argn > 1) root = args[1];
+
+    test_sample_golden();
+    test_cycles();
+    test_seek();
+    test_image();
+    test_regions();
+    test_scanner();
+    test_goto();
+    test_trace();
+    test_crowd();
+    test_batch();
+
+    printf("%d проверок, провалено %d\n", checks, failures);
+    return failures != 0;
+}